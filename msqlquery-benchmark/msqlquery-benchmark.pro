@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# MSqlQuery benchmark:
+#---------------------
+# a headless QTest benchmark of the async layer, using an in-memory SQLite database.
+# run it with a QTest output format to get machine-readable results, eg.:
+#   ./msqlquery-benchmark -o results.csv,csv
+#   ./msqlquery-benchmark -o results.xml,xml
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+include(../msqlquery-demo/msqlquery/msqlquery.pri)
+
+TARGET = msqlquery-benchmark
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+
+SOURCES += tst_msqlquerybenchmark.cpp
@@ -0,0 +1,216 @@
+#include <QtTest>
+#include "msqldatabase.h"
+#include "msqlquery.h"
+#include "msqlquerymodel.h"
+
+//the benchmark uses its own connection, filled with a table of tableRowCount rows
+static const QString connectionName = QStringLiteral("msqlquery_benchmark");
+static const int tableRowCount = 100000;
+
+class MSqlQueryBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void exec_data();
+    void exec();
+    void execAsync_data();
+    void execAsync();
+    void next_data();
+    void next();
+    void record_data();
+    void record();
+    void value_data();
+    void value();
+    void execBatch_data();
+    void execBatch();
+    void modelReset_data();
+    void modelReset();
+    void getAllRecords_data();
+    void getAllRecords();
+private:
+    //adds a "rows" column with the result sizes used by data-driven benchmarks
+    void addResultSizes();
+    static QString selectQuery(int rows);
+};
+
+void MSqlQueryBenchmark::initTestCase() {
+    MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(":memory:");
+    QVERIFY2(db.open(), qPrintable(db.lastError().text()));
+    MSqlQuery query(nullptr, db);
+    QVERIFY(query.exec("create table people (id integer primary key, "
+                       "firstname varchar(20), lastname varchar(20), age integer)"));
+    QVERIFY(query.exec("create table inserts (id integer primary key, name varchar(20), age integer)"));
+    QVariantList firstNames;
+    QVariantList lastNames;
+    QVariantList ages;
+    for(int i=0; i<tableRowCount; i++) {
+        firstNames << QString("first%0").arg(i);
+        lastNames << QString("last%0").arg(i);
+        ages << i%100;
+    }
+    query.prepare("insert into people(firstname, lastname, age) values(?, ?, ?)");
+    query.addBindValue(firstNames);
+    query.addBindValue(lastNames);
+    query.addBindValue(ages);
+    QVERIFY2(query.execBatch(), qPrintable(query.lastError().text()));
+}
+
+void MSqlQueryBenchmark::cleanupTestCase() {
+    MSqlDatabase::database(connectionName).close();
+}
+
+void MSqlQueryBenchmark::addResultSizes() {
+    QTest::addColumn<int>("rows");
+    QTest::newRow("1") << 1;
+    QTest::newRow("100") << 100;
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("100000") << 100000;
+}
+
+QString MSqlQueryBenchmark::selectQuery(int rows) {
+    return QString("select * from people limit %0").arg(rows);
+}
+
+void MSqlQueryBenchmark::exec_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::exec() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QBENCHMARK {
+        query.exec(selectQuery(rows));
+    }
+    QCOMPARE(query.result().rowCount(), rows);
+}
+
+void MSqlQueryBenchmark::execAsync_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::execAsync() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QSignalSpy spy(&query, &MSqlQuery::resultsReady);
+    //measures the whole round trip: submitting the query, executing it and delivering the result to this thread
+    QBENCHMARK {
+        query.execAsync(selectQuery(rows));
+        QVERIFY(spy.wait());
+    }
+    QCOMPARE(query.result().rowCount(), rows);
+}
+
+void MSqlQueryBenchmark::next_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::next() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QVERIFY(query.exec(selectQuery(rows)));
+    int count = 0;
+    QBENCHMARK {
+        query.seek(-1); //before first row
+        while(query.next())
+            count++;
+    }
+    QVERIFY(count >= rows);
+}
+
+void MSqlQueryBenchmark::record_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::record() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QVERIFY(query.exec(selectQuery(rows)));
+    int fieldCount = 0;
+    QBENCHMARK {
+        query.seek(-1); //before first row
+        while(query.next())
+            fieldCount += query.record().count();
+    }
+    QVERIFY(fieldCount > 0);
+}
+
+void MSqlQueryBenchmark::value_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::value() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QVERIFY(query.exec(selectQuery(rows)));
+    int columnCount = query.result().columnCount();
+    int validCount = 0;
+    QBENCHMARK {
+        query.seek(-1); //before first row
+        while(query.next()) {
+            for(int i=0; i<columnCount; i++)
+                validCount += query.value(i).isValid() ? 1 : 0;
+        }
+    }
+    QVERIFY(validCount > 0);
+}
+
+void MSqlQueryBenchmark::execBatch_data() {
+    QTest::addColumn<int>("rows");
+    QTest::newRow("100") << 100;
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("100000") << 100000;
+}
+
+void MSqlQueryBenchmark::execBatch() {
+    QFETCH(int, rows);
+    QVariantList names;
+    QVariantList ages;
+    for(int i=0; i<rows; i++) {
+        names << QString("name%0").arg(i);
+        ages << i%100;
+    }
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QBENCHMARK {
+        query.prepare("insert into inserts(name, age) values(?, ?)");
+        query.addBindValue(names);
+        query.addBindValue(ages);
+        QVERIFY(query.execBatch());
+    }
+    QVERIFY(query.exec("delete from inserts"));
+}
+
+void MSqlQueryBenchmark::modelReset_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::modelReset() {
+    QFETCH(int, rows);
+    MSqlQueryModel model;
+    QBENCHMARK {
+        model.setQuery(selectQuery(rows), connectionName);
+    }
+    QCOMPARE(model.rowCount(), rows);
+}
+
+void MSqlQueryBenchmark::getAllRecords_data() {
+    addResultSizes();
+}
+
+void MSqlQueryBenchmark::getAllRecords() {
+    QFETCH(int, rows);
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QVERIFY(query.exec(selectQuery(rows)));
+    QList<QSqlRecord> records;
+    QBENCHMARK {
+        records = query.getAllRecords();
+    }
+    QCOMPARE(records.size(), rows);
+}
+
+QTEST_GUILESS_MAIN(MSqlQueryBenchmark)
+
+#include "tst_msqlquerybenchmark.moc"
@@ -0,0 +1,205 @@
+#include "msqlbulkloader.h"
+#include "msqlconnection.h"
+#include "msqlstatementcache.h"
+#include "msqlstatistics.h"
+#include "msqlquerytimings.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QIODevice>
+#include <QVector>
+#include <QFutureInterface>
+#include <QAtomicInteger>
+
+struct MSqlBulkLoader::Load {
+    Load(QIODevice* device, MSqlRowFormat::Format format):device(device), reader(device, format){}
+    QString statement;
+    //the connection is looked up for every chunk (by its position in the pool), as it can be replaced
+    QString connectionName;
+    int connectionIndex = -1;
+    int chunkSize = defaultChunkSize;
+    bool isSkippingHeader = false;
+    //accessed only from the connection's thread while the load is running
+    QIODevice* device;
+    MSqlRowReader reader;
+    int columnCount = -1; //the number of fields of the first row, all rows must have the same number of fields
+    int chunkCount = 0;
+    QFutureInterface<MSqlResult> futureInterface;
+    //progress, written in the connection's thread and read in the client thread
+    QAtomicInteger<qint64> rowsLoaded;
+    QAtomicInteger<qint64> bytesRead;
+    qint64 bytesTotal = -1;
+    //written in the connection's thread before the load's future finishes,
+    //read in the client thread only after that
+    QSqlError error;
+};
+
+MSqlBulkLoader::MSqlBulkLoader(const QString &statement, QObject *parent, MSqlDatabase db)
+    : QObject(parent), db(db), m_statement(statement) {
+    connect(&m_watcher, &QFutureWatcherBase::progressValueChanged, this, &MSqlBulkLoader::watcherProgress);
+    connect(&m_watcher, &QFutureWatcherBase::finished, this, &MSqlBulkLoader::watcherFinished);
+}
+
+void MSqlBulkLoader::setFormat(MSqlRowFormat::Format format) {
+    m_format = format;
+}
+
+MSqlRowFormat::Format MSqlBulkLoader::format() const {
+    return m_format;
+}
+
+void MSqlBulkLoader::setChunkSize(int rows) {
+    m_chunkSize = qMax(rows, 1);
+}
+
+int MSqlBulkLoader::chunkSize() const {
+    return m_chunkSize;
+}
+
+void MSqlBulkLoader::setSkipHeader(bool skip) {
+    m_isSkippingHeader = skip;
+}
+
+bool MSqlBulkLoader::isSkippingHeader() const {
+    return m_isSkippingHeader;
+}
+
+QFuture<MSqlResult> MSqlBulkLoader::load(QIODevice *device) {
+    QSharedPointer<Load> load(new Load(device, m_format));
+    load->statement = m_statement;
+    load->connectionName = db.connectionName();
+    load->connectionIndex = MSqlDatabase::connectionIndexForQuery(db.connectionName());
+    load->chunkSize = m_chunkSize;
+    load->isSkippingHeader = m_isSkippingHeader && m_format != MSqlRowFormat::Binary;
+    load->bytesTotal = device->isSequential() ? -1 : device->size();
+    load->bytesRead.store(device->isSequential() ? -1 : device->pos());
+    load->futureInterface.reportStarted();
+    postChunk(load);
+    bool wasBusy = isBusy();
+    m_load = load;
+    m_watcher.setFuture(load->futureInterface.future());
+    if(!wasBusy)
+        emit busyToggled(true);
+    return load->futureInterface.future();
+}
+
+void MSqlBulkLoader::cancel() {
+    if(m_load)
+        m_load->futureInterface.cancel(); //checked in the connection's thread before every chunk
+}
+
+bool MSqlBulkLoader::isBusy() const {
+    return m_watcher.isRunning();
+}
+
+qint64 MSqlBulkLoader::rowsLoaded() const {
+    return m_load ? m_load->rowsLoaded.load() : 0;
+}
+
+qint64 MSqlBulkLoader::bytesRead() const {
+    return m_load ? m_load->bytesRead.load() : 0;
+}
+
+QSqlError MSqlBulkLoader::lastError() const {
+    return m_lastError;
+}
+
+void MSqlBulkLoader::postChunk(const QSharedPointer<Load> &load) {
+    //chunks are background jobs, so that interactive queries do not wait behind the load
+    bool isPosted = MSqlDatabase::postToConnection(load->connectionName, load->connectionIndex, MSqlPriority::Background,
+                                                   [=](MSqlConnection* connection){
+        loadChunk(load, connection);
+    });
+    if(!isPosted) {
+        load->error = MSqlDatabase::noConnectionError(load->connectionName);
+        finishLoad(load);
+    }
+}
+
+void MSqlBulkLoader::loadChunk(const QSharedPointer<Load> &load, MSqlConnection* connection) {
+    auto fail = [&](const QSqlError& error) {
+        load->error = error;
+        finishLoad(load);
+    };
+    if(load->futureInterface.isCanceled())
+        return fail(QSqlError(QString(), QStringLiteral("the load has been canceled"), QSqlError::UnknownError));
+    qint64 startedAt = MSqlQueryTimings::now();
+    QVariantList row;
+    if(load->chunkCount == 0 && load->isSkippingHeader)
+        load->reader.readRow(&row);
+    //only a single chunk is held in memory, as the values of every placeholder (as expected by QSqlQuery::execBatch())
+    QVector<QVariantList> columns;
+    int rows = 0;
+    while(rows < load->chunkSize && load->reader.readRow(&row)) {
+        if(load->columnCount == -1)
+            load->columnCount = row.size();
+        if(row.size() != load->columnCount)
+            return fail(QSqlError(QString(), QStringLiteral("row %0 has %1 fields, expected %2").arg(load->reader.rowNumber())
+                                  .arg(row.size()).arg(load->columnCount), QSqlError::StatementError));
+        if(columns.isEmpty()) {
+            columns.resize(load->columnCount);
+            for(QVariantList& column : columns)
+                column.reserve(load->chunkSize);
+        }
+        for(int i=0; i<row.size(); i++)
+            columns[i].append(row.at(i));
+        rows++;
+    }
+    if(load->reader.hasError())
+        return fail(QSqlError(QString(), load->reader.errorString(), QSqlError::StatementError));
+    if(rows > 0) {
+        QSqlDatabase qdb = QSqlDatabase::database(connection->qtConnectionName(), false);
+        if(!qdb.transaction())
+            return fail(qdb.lastError());
+        bool success;
+        QSqlError error;
+        { //the query must be finished before committing, as some drivers refuse to commit while statements are active
+            QSqlQuery ownQuery(qdb);
+            QSqlQuery* query = connection->statementCache()->prepared(load->statement);
+            if(!query) { //the statement is not cached (or has failed to prepare, ownQuery reports the error in that case)
+                query = &ownQuery;
+                query->prepare(load->statement);
+            }
+            for(const QVariantList& column : columns)
+                query->addBindValue(column);
+            success = query->execBatch();
+            error = query->lastError();
+            query->finish();
+        }
+        if(!success) {
+            qdb.rollback();
+            return fail(error);
+        }
+        if(!qdb.commit()) {
+            error = qdb.lastError();
+            qdb.rollback();
+            return fail(error);
+        }
+        load->rowsLoaded.fetchAndAddRelaxed(rows);
+        connection->statistics()->recordQuery(load->statement, startedAt, MSqlQueryTimings::now(), 0);
+    }
+    if(!load->device->isSequential())
+        load->bytesRead.store(load->device->pos());
+    load->futureInterface.setProgressValue(++load->chunkCount);
+    if(rows < load->chunkSize) //the end of the device has been reached
+        return finishLoad(load);
+    //the next chunk is posted as a separate job, so that queries posted meanwhile are not blocked by the whole load
+    postChunk(load);
+}
+
+void MSqlBulkLoader::finishLoad(const QSharedPointer<Load> &load) {
+    MSqlResultBuilder builder((QSqlRecord()));
+    builder.setLastError(load->error);
+    load->futureInterface.reportResult(builder.take());
+    load->futureInterface.reportFinished();
+}
+
+void MSqlBulkLoader::watcherProgress() {
+    emit progress(m_load->rowsLoaded.load(), m_load->bytesRead.load(), m_load->bytesTotal);
+}
+
+void MSqlBulkLoader::watcherFinished() {
+    m_lastError = m_load->error;
+    watcherProgress(); //progress notifications are throttled, the last one may have been skipped
+    emit finished(m_lastError.type() == QSqlError::NoError);
+    emit busyToggled(false);
+}
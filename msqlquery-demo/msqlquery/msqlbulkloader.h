@@ -0,0 +1,88 @@
+#ifndef MSQLBULKLOADER_H
+#define MSQLBULKLOADER_H
+
+#include <QObject>
+#include <QSqlError>
+#include <QSharedPointer>
+#include <QFuture>
+#include <QFutureWatcher>
+#include "msqldatabase.h"
+#include "msqlresult.h"
+#include "msqlrowformat.h"
+
+class QIODevice;
+
+//loads rows from a device (CSV, TSV or binary rows, see MSqlRowFormat) into the database using a single statement
+//(eg. "INSERT INTO people(firstname, lastname) VALUES(?, ?)", with a placeholder for every field of a row)
+//rows are read in the connection's thread, chunkSize() rows at a time, and every chunk is executed with
+//QSqlQuery::execBatch() inside its own transaction, so that only a single chunk is held in memory
+//chunks are executed as separate jobs, so that other queries on the connection can run between them
+//if the connection is replaced (see MSqlDatabase::addDatabase), the next chunks are executed on the connection
+//that replaces it (at the same position in the pool), and the load fails if there is none
+//
+//example:
+//  QFile file("people.csv");
+//  file.open(QIODevice::ReadOnly);
+//  MSqlBulkLoader* loader = new MSqlBulkLoader("INSERT INTO people(firstname, lastname) VALUES(?, ?)", this);
+//  loader->setSkipHeader(true);
+//  connect(loader, &MSqlBulkLoader::progress, this, &MyClass::showProgress);
+//  loader->load(&file);
+class MSqlBulkLoader : public QObject {
+    Q_OBJECT
+public:
+    static const int defaultChunkSize = 10000;
+    explicit MSqlBulkLoader(const QString& statement, QObject* parent = 0, MSqlDatabase db = MSqlDatabase::database());
+
+    //the following settings apply to the next load
+    void setFormat(MSqlRowFormat::Format format);
+    MSqlRowFormat::Format format()const;
+    void setChunkSize(int rows);
+    int chunkSize()const;
+    //skips the first row (the header of a CSV/TSV file)
+    void setSkipHeader(bool skip);
+    bool isSkippingHeader()const;
+
+    //loads all rows from device, which must be open for reading
+    //the device is read in the connection's thread, so it must be a device that does not need an event loop
+    //(eg. QFile, QBuffer or QProcess after it finished, not a socket), it must not be used by other threads
+    //until the load finishes, and it must outlive the load
+    //the returned future reports a single empty result (holding the error of the load, if any) when all rows are loaded
+    //if a chunk fails, the load stops, chunks committed before it are kept
+    QFuture<MSqlResult> load(QIODevice* device);
+    //stops the running load after the chunk being executed (chunks committed before are kept)
+    void cancel();
+    bool isBusy()const;
+
+    //the following functions return information about the running (or last) load
+    qint64 rowsLoaded()const;
+    qint64 bytesRead()const;
+    QSqlError lastError()const;
+signals:
+    //emitted after chunks are committed, bytesRead and bytesTotal are -1 if the device is sequential
+    void progress(qint64 rowsLoaded, qint64 bytesRead, qint64 bytesTotal);
+    //emitted when all rows have been loaded (success = true), or when the load fails or is canceled (success = false)
+    void finished(bool success);
+    void busyToggled(bool isBusy);
+private:
+    struct Load;
+    //runs in the connection's thread, executes a chunk and posts the next one
+    static void loadChunk(const QSharedPointer<Load>& load, MSqlConnection* connection);
+    //posts the next chunk to the load's connection, the load fails if the connection does not exist anymore
+    static void postChunk(const QSharedPointer<Load>& load);
+    static void finishLoad(const QSharedPointer<Load>& load);
+    void watcherProgress();
+    void watcherFinished();
+
+    MSqlDatabase db;
+    QString m_statement;
+    MSqlRowFormat::Format m_format = MSqlRowFormat::Csv;
+    int m_chunkSize = defaultChunkSize;
+    bool m_isSkippingHeader = false;
+    QFutureWatcher<MSqlResult> m_watcher;
+    //the load being watched by m_watcher
+    QSharedPointer<Load> m_load;
+    //the error of the last finished load, accessed only from the client thread
+    QSqlError m_lastError;
+};
+
+#endif // MSQLBULKLOADER_H
@@ -0,0 +1,100 @@
+#include "msqlconnection.h"
+#include "msqlthread.h"
+#include "msqlstatementcache.h"
+#include "msqlstatistics.h"
+#include <QSqlDatabase>
+#include <QSemaphore>
+#include <QSqlDriver>
+#include <QVariant>
+#ifdef MSQLQUERY_SQLITE_INTERRUPT
+#include <sqlite3.h>
+#endif
+
+MSqlConnection::MSqlConnection(const QString &qtConnectionName, const QSharedPointer<MSqlSlowQueryLog> &slowQueryLog,
+                               MSqlThread *sharedThread)
+    : m_qtConnectionName(qtConnectionName), m_thread(sharedThread ? sharedThread : new MSqlThread),
+      m_isThreadOwned(!sharedThread), m_statementCache(new MSqlStatementCache(qtConnectionName)),
+      m_statistics(new MSqlStatisticsCollector), m_slowQueryLog(slowQueryLog) {
+    if(m_isThreadOwned)
+        m_thread->setObjectName(qtConnectionName); //names the thread in MSqlTracer's traces
+    m_thread->connectionAttached();
+}
+
+MSqlConnection::~MSqlConnection() {
+    //queries stop using their workers before the workers are destroyed
+    //the references are cleared from this thread, as a query may keep its reference locked while it waits
+    //for the connection's thread (see MSqlQuery::exec())
+    QList<QSharedPointer<MSqlWorkerRef>> refs;
+    {
+        QMutexLocker locker(&m_workersMutex);
+        refs = m_workers.values();
+    }
+    for(const QSharedPointer<MSqlWorkerRef>& ref : refs) {
+        QMutexLocker locker(&ref->mutex);
+        ref->worker = nullptr;
+    }
+    //cached statements must be destroyed in the connection's thread, before the connection is removed
+    //this is queued as a background job, so it runs after all the jobs queued on the thread so far
+    //(a job never runs before the jobs of higher or equal priority queued before it), as they may use the connection
+    QSemaphore isCleared;
+    m_thread->postJob(getWorker(), MSqlPriority::Background, [&]{
+        m_statementCache->clear();
+        //the workers' queries must be destroyed before the connection is removed
+        QHash<QObject*, QSharedPointer<MSqlWorkerRef>> workers;
+        {
+            QMutexLocker locker(&m_workersMutex);
+            workers.swap(m_workers);
+        }
+        qDeleteAll(workers.keys());
+        //a shared thread keeps running after the connection is destroyed, so the connection is removed
+        //from its thread here, instead of being left to QSqlDatabase's cleanup
+        if(!m_isThreadOwned)
+            QSqlDatabase::removeDatabase(m_qtConnectionName);
+        isCleared.release();
+    });
+    isCleared.acquire();
+    m_thread->connectionDetached();
+    if(m_isThreadOwned)
+        delete m_thread;
+    delete m_statementCache;
+}
+
+QSharedPointer<MSqlWorkerRef> MSqlConnection::workerAttached(QObject *worker) {
+    QSharedPointer<MSqlWorkerRef> ref(new MSqlWorkerRef);
+    ref->worker = worker;
+    QMutexLocker locker(&m_workersMutex);
+    m_workers.insert(worker, ref);
+    return ref;
+}
+
+void MSqlConnection::workerDetached(QObject *worker) {
+    QMutexLocker locker(&m_workersMutex);
+    m_workers.remove(worker);
+}
+
+QObject *MSqlConnection::getWorker() const {
+    return m_thread->getWorker();
+}
+
+void MSqlConnection::updateNativeHandle(const QSqlDatabase &db) {
+#ifdef MSQLQUERY_SQLITE_INTERRUPT
+    sqlite3* handle = nullptr;
+    QVariant v = db.isOpen() ? db.driver()->handle() : QVariant();
+    if(v.isValid() && qstrcmp(v.typeName(), "sqlite3*") == 0)
+        handle = *static_cast<sqlite3**>(v.data());
+    m_sqliteHandle.storeRelease(handle);
+#else
+    Q_UNUSED(db)
+#endif
+}
+
+bool MSqlConnection::interrupt() {
+#ifdef MSQLQUERY_SQLITE_INTERRUPT
+    sqlite3* handle = m_sqliteHandle.loadAcquire();
+    if(!handle) return false;
+    sqlite3_interrupt(handle);
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef MSQLCONNECTION_H
+#define MSQLCONNECTION_H
+
+#include <QString>
+#include <QAtomicPointer>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QHash>
+#include <QSharedPointer>
+
+class QObject;
+class MSqlThread;
+class MSqlStatementCache;
+class MSqlStatisticsCollector;
+class MSqlSlowQueryLog;
+class QSqlDatabase;
+#ifdef MSQLQUERY_SQLITE_INTERRUPT
+struct sqlite3;
+#endif
+
+//a query worker attached to a connection, as seen by the worker's query from the client thread
+//the connection clears it (from the thread destroying the connection) before destroying the worker,
+//so the query must keep the mutex locked while it uses the worker
+//this struct is internal to the library
+struct MSqlWorkerRef {
+    QMutex mutex;
+    QObject* worker = nullptr;
+};
+
+//a single QSqlDatabase connection together with the thread it lives in
+//the thread is either owned by the connection, or a shared thread that several connections are pinned to
+//(see MSqlDatabase::setSharedThreadCount), in both cases the connection is only used from that thread
+//a connection name passed to MSqlDatabase::addDatabase maps to one or more MSqlConnection objects
+//this class is internal to the library
+class MSqlConnection {
+public:
+    //the slow query log is shared by all connections in a pool
+    //if sharedThread is null, the connection starts its own thread, otherwise it is pinned to sharedThread
+    //(which must outlive the connection)
+    MSqlConnection(const QString& qtConnectionName, const QSharedPointer<MSqlSlowQueryLog>& slowQueryLog,
+                   MSqlThread* sharedThread = nullptr);
+    //blocks until the jobs queued on the connection's thread have run, and until the thread is terminated
+    //(or until the connection is removed from its shared thread)
+    ~MSqlConnection();
+    
+    //the name used to register the connection with QSqlDatabase
+    //QSqlDatabase::database() should be called with this name (from the connection's thread only)
+    QString qtConnectionName()const{return m_qtConnectionName;}
+    MSqlThread* thread()const{return m_thread;}
+    QObject* getWorker()const;
+    //the connection's prepared statement cache, to be used from the connection's thread only
+    //(except for the functions marked as thread-safe in MSqlStatementCache)
+    MSqlStatementCache* statementCache()const{return m_statementCache;}
+    //the connection's statistics, shared with the results it produced (so that they can be released later)
+    QSharedPointer<MSqlStatisticsCollector> statistics()const{return m_statistics;}
+    QSharedPointer<MSqlSlowQueryLog> slowQueryLog()const{return m_slowQueryLog;}
+    //must be called from the connection's thread after the connection is opened or closed,
+    //it keeps the driver's native handle used to interrupt running statements
+    void updateNativeHandle(const QSqlDatabase& db);
+    //interrupts the statement running on the connection, thread-safe
+    //returns false if the driver does not support interruption, currently only SQLite connections
+    //can be interrupted (when the library is built with MSQLQUERY_SQLITE_INTERRUPT, see msqlquery.pri)
+    //note that the interruption affects any statement running on the connection,
+    //and any cursor left open on it (see openCursorCount())
+    bool interrupt();
+    //the number of lazy cursors left open on the connection by query workers, thread-safe
+    //the connection is not interrupted while cursors are open, as that would abort them too
+    int openCursorCount()const{return m_openCursorCount.load();}
+    void cursorOpened(){m_openCursorCount.ref();}
+    void cursorClosed(){m_openCursorCount.deref();}
+    //query workers attached to the connection, they are destroyed with the connection (in its thread),
+    //as they keep pointers to it, and a shared thread does not destroy them when the connection is removed
+    //workerAttached() returns the reference the worker's query uses it through
+    //the following functions are thread-safe
+    QSharedPointer<MSqlWorkerRef> workerAttached(QObject* worker);
+    void workerDetached(QObject* worker);
+private:
+    Q_DISABLE_COPY(MSqlConnection)
+    QString m_qtConnectionName;
+    MSqlThread* m_thread;
+    bool m_isThreadOwned;
+    MSqlStatementCache* m_statementCache;
+    QSharedPointer<MSqlStatisticsCollector> m_statistics;
+    QSharedPointer<MSqlSlowQueryLog> m_slowQueryLog;
+    QAtomicInt m_openCursorCount;
+    QMutex m_workersMutex;
+    QHash<QObject*, QSharedPointer<MSqlWorkerRef>> m_workers; //guarded by m_workersMutex
+#ifdef MSQLQUERY_SQLITE_INTERRUPT
+    QAtomicPointer<sqlite3> m_sqliteHandle;
+#endif
+};
+
+#endif // MSQLCONNECTION_H
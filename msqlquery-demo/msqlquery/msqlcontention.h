@@ -0,0 +1,60 @@
+#ifndef MSQLCONTENTION_H
+#define MSQLCONTENTION_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QReadWriteLock>
+
+//lock contention accounting, used to find out where scaling breaks down (see MSqlDatabase::lockContentions)
+//a lock acquisition is contended when the lock cannot be acquired without waiting,
+//the lockers below try to acquire the lock first, and count the acquisition as contended if that fails
+//this file is internal to the library
+
+namespace MSqlContention {
+extern QAtomicInt connectionsLock; //the lock guarding the connections registry (MSqlConnections)
+extern QAtomicInt workerLock; //the locks guarding the running query of query workers
+}
+
+class MSqlCountingMutexLocker {
+public:
+    MSqlCountingMutexLocker(QMutex* mutex, QAtomicInt* contentions):m_mutex(mutex) {
+        if(!m_mutex->tryLock()) {
+            contentions->ref();
+            m_mutex->lock();
+        }
+    }
+    ~MSqlCountingMutexLocker(){ m_mutex->unlock(); }
+private:
+    Q_DISABLE_COPY(MSqlCountingMutexLocker)
+    QMutex* m_mutex;
+};
+
+class MSqlCountingReadLocker {
+public:
+    MSqlCountingReadLocker(QReadWriteLock* lock, QAtomicInt* contentions):m_lock(lock) {
+        if(!m_lock->tryLockForRead()) {
+            contentions->ref();
+            m_lock->lockForRead();
+        }
+    }
+    ~MSqlCountingReadLocker(){ m_lock->unlock(); }
+private:
+    Q_DISABLE_COPY(MSqlCountingReadLocker)
+    QReadWriteLock* m_lock;
+};
+
+class MSqlCountingWriteLocker {
+public:
+    MSqlCountingWriteLocker(QReadWriteLock* lock, QAtomicInt* contentions):m_lock(lock) {
+        if(!m_lock->tryLockForWrite()) {
+            contentions->ref();
+            m_lock->lockForWrite();
+        }
+    }
+    ~MSqlCountingWriteLocker(){ m_lock->unlock(); }
+private:
+    Q_DISABLE_COPY(MSqlCountingWriteLocker)
+    QReadWriteLock* m_lock;
+};
+
+#endif // MSQLCONTENTION_H
@@ -1,39 +1,85 @@
 #include "msqldatabase.h"
 #include "qthreadutils.h"
 #include "msqlthread.h"
+#include "msqlconnection.h"
+#include "msqlstatementcache.h"
+#include "msqlresultcache.h"
+#include "msqlslowquerylog.h"
+#include "msqlcontention.h"
 #include <QSqlDatabase>
 #include <QStringList>
 #include <QSqlDriver>
 #include <QDebug>
 #include <QReadWriteLock>
-#include <QWriteLocker>
-#include <QReadLocker>
 #include <QGlobalStatic>
 #include <QCoreApplication>
 
 const QString MSqlDatabase::defaultConnectionName(QString(QSqlDatabase::defaultConnection)+"_msqlquery_default");
 
 struct MSqlConnections {
-    QHash<QString, MSqlThread*> dict;
+    QHash<QString, QList<MSqlConnection*>> dict;
+    QHash<QString, QSharedPointer<MSqlResultCache>> resultCaches;
+    //the number of reader connections of routed groups (the writer is the first connection in the group)
+    QHash<QString, int> readerCounts;
+    //threads shared by connections (see MSqlDatabase::setSharedThreadCount), started when needed
+    QList<MSqlThread*> sharedThreads;
+    int sharedThreadCount = 0;
     bool isPostRoutineAdded = false;
     mutable QReadWriteLock lock;
 };
 Q_GLOBAL_STATIC(MSqlConnections, getMSqlConnections)
 
+QAtomicInt MSqlContention::connectionsLock;
+QAtomicInt MSqlContention::workerLock;
+
 static void MSqlCleanup() {
     //must be called before QSqlDatabase cleanup routine
     //so, it must be added after QSqlDatabase
     MSqlConnections* connections = getMSqlConnections();
-    QWriteLocker locker(&connections->lock);
-    //destruct all connection's threads 
+    QHash<QString, QList<MSqlConnection*>> dict;
+    QList<MSqlThread*> sharedThreads;
+    {
+        MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+        Q_UNUSED(locker)
+        dict.swap(connections->dict);
+        sharedThreads.swap(connections->sharedThreads);
+    }
+    //destruct all connections (and their threads) after releasing the lock, as destroying a connection waits for
+    //the jobs queued on its thread, and these may need the lock (eg. notification handlers)
     //this causes calling thread to block until all threads are terminated
-    for(auto i = connections->dict.begin(); i!=connections->dict.end(); ++i)
-        delete i.value();
-    //make sure any of the threads getting destructed do not attempt to access
-    //MSqlConnections because this will cause a deadlock
-    connections->dict.clear();
+    for(auto i = dict.begin(); i!=dict.end(); ++i)
+        qDeleteAll(i.value());
+    //shared threads are destructed after all the connections pinned to them
+    qDeleteAll(sharedThreads);
+}
+
+//posts the functor to the thread of every connection in the list
+//the functor gets called with the connection's QSqlDatabase object
+template <typename Func>
+static void PostToConnections(const QList<MSqlConnection*>& connections, Func f) {
+    for(MSqlConnection* connection : connections) {
+        QString qtConnectionName = connection->qtConnectionName();
+        PostToWorker(connection->getWorker(), [=]{
+            f(QSqlDatabase::database(qtConnectionName, false));
+        });
+    }
 }
 
+//executes the functor in the thread of every connection in the list and blocks until done
+//the functor gets called with the connection and its QSqlDatabase object
+//returns true only if the functor returned true for all connections
+template <typename Func>
+static bool CallByConnections(const QList<MSqlConnection*>& connections, Func f) {
+    bool result = true;
+    for(MSqlConnection* connection : connections) {
+        QString qtConnectionName = connection->qtConnectionName();
+        bool connectionResult = CallByWorker(connection->getWorker(), [=]{
+            return f(connection, QSqlDatabase::database(qtConnectionName, false));
+        });
+        result = result && connectionResult;
+    }
+    return result;
+}
 
 MSqlDatabase::MSqlDatabase() {
     
@@ -43,24 +89,53 @@ MSqlDatabase::~MSqlDatabase() {
     
 }
 
-MSqlDatabase MSqlDatabase::addDatabase(const QString &type, const QString &connectionName) {
+MSqlDatabase MSqlDatabase::addDatabase(const QString &type, const QString &connectionName, int poolSize) {
+    return addPool(type, connectionName, qMax(poolSize, 1), 0);
+}
+
+MSqlDatabase MSqlDatabase::addRoutedDatabase(const QString &type, int readerCount, const QString &connectionName) {
+    readerCount = qMax(readerCount, 1);
+    return addPool(type, connectionName, readerCount+1, readerCount);
+}
+
+MSqlDatabase MSqlDatabase::addPool(const QString &type, const QString &connectionName, int poolSize, int readerCount) {
     MSqlDatabase db;
     db.m_connectionName = connectionName;
     MSqlConnections* connections = getMSqlConnections();
-    QWriteLocker locker(&connections->lock);
+    QList<MSqlConnection*> oldPool;
+    {
+        MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+        Q_UNUSED(locker)
+        //remove old connections if they already exist
+        oldPool = connections->dict.take(connectionName);
+        connections->resultCaches.remove(connectionName); //results may not be valid for the new connection
+        connections->readerCounts.remove(connectionName);
+    }
+    //old connections are destructed without holding the lock, as destroying a connection waits for the jobs queued
+    //on its thread (a shared thread may be running other connections' jobs), and these may need the lock
+    //they are destructed before the new connections are created, as they are registered with the same names
+    qDeleteAll(oldPool);
+    MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
     Q_UNUSED(locker)
-    if(connections->dict.contains(connectionName)){
-        //destruct and remove old connection if one already exists
-        delete connections->dict.value(connectionName);
-        connections->dict.remove(connectionName);
+    QList<MSqlConnection*> pool;
+    QSharedPointer<MSqlSlowQueryLog> slowQueryLog(new MSqlSlowQueryLog);
+    for(int i=0; i<poolSize; i++) {
+        //the first connection in the pool is registered in QSqlDatabase with the same name
+        QString qtConnectionName = i==0 ? connectionName :
+                                          QString("%0_msqlpool_%1").arg(connectionName).arg(i);
+        //create new thread for connection
+        MSqlConnection* connection = new MSqlConnection(qtConnectionName, slowQueryLog, sharedThreadForConnection());
+        pool.append(connection);
+        //create database connection in the connection's thread
+        //it is posted rather than called, as a shared thread may be busy with queries on other connections, and the lock
+        //must not be held while waiting for them. everything done later with the connection is queued after it
+        PostToWorker(connection->getWorker(), [=]{
+            QSqlDatabase::addDatabase(type, qtConnectionName);
+        });
     }
-    //create new thread for connection
-    MSqlThread* thread = new MSqlThread();
-    connections->dict.insert(connectionName, thread);
-    //create database connection in newly created thread
-    CallByWorker(thread->getWorker(), [=]{
-        QSqlDatabase::addDatabase(type, connectionName);
-    });
+    connections->dict.insert(connectionName, pool);
+    if(readerCount > 0)
+        connections->readerCounts.insert(connectionName, readerCount);
     if(!connections->isPostRoutineAdded){ //if post routine not registered
         //register post routine after calling QSqlDatabase::addDatabase
         //since postRoutines are called in reverse order of their addition
@@ -76,51 +151,74 @@ MSqlDatabase MSqlDatabase::database(const QString &connectionName) {
     return db;
 }
 
+void MSqlDatabase::setSharedThreadCount(int count) {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    connections->sharedThreadCount = qMax(count, 0);
+}
+
+int MSqlDatabase::sharedThreadCount() {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    return connections->sharedThreadCount;
+}
+
+MSqlThread* MSqlDatabase::sharedThreadForConnection() {
+    MSqlConnections* connections = getMSqlConnections();
+    int count = connections->sharedThreadCount;
+    if(count == 0) return nullptr;
+    //threads beyond count (started before the count has been lowered) are not used for new connections
+    MSqlThread* leastLoaded = nullptr;
+    for(MSqlThread* thread : connections->sharedThreads.mid(0, count)) {
+        if(!leastLoaded || thread->connectionCount() < leastLoaded->connectionCount() ||
+                (thread->connectionCount() == leastLoaded->connectionCount() && thread->load() < leastLoaded->load()))
+            leastLoaded = thread;
+    }
+    //a new thread is started as long as the pool is not full and all threads are serving connections
+    if(connections->sharedThreads.size() < count && (!leastLoaded || leastLoaded->connectionCount() > 0)) {
+        MSqlThread* thread = new MSqlThread;
+        thread->setObjectName(QString("msqlquery_shared_%0").arg(connections->sharedThreads.size()));
+        connections->sharedThreads.append(thread);
+        return thread;
+    }
+    return leastLoaded;
+}
+
 void MSqlDatabase::setHostName(const QString &host) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setHostName(host);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setHostName(host);
     });
 }
 
 void MSqlDatabase::setDatabaseName(const QString &name) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setDatabaseName(name);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setDatabaseName(name);
     });
 }
 
 void MSqlDatabase::setUserName(const QString &name) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setUserName(name);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setUserName(name);
     });
 }
 
 void MSqlDatabase::setPassword(const QString& password) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setPassword(password);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setPassword(password);
     });
 }
 
 void MSqlDatabase::setConnectionOptions(const QString &options) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setConnectOptions(options);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setConnectOptions(options);
     });
 }
 
 void MSqlDatabase::setPort(int port) {
-    QString connectionName = m_connectionName;
-    PostToWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false)
-                .setPort(port);
+    PostToConnections(connectionsForName(m_connectionName), [=](QSqlDatabase db){
+        db.setPort(port);
     });
 }
 
@@ -167,6 +265,7 @@ int MSqlDatabase::port() {
 }
 
 bool MSqlDatabase::transaction() {
+    if(!isSingleConnection("transaction")) return false;
     QString connectionName = m_connectionName;
     return CallByWorker(workerForConnection(connectionName), [=]{
         return QSqlDatabase::database(connectionName, false).transaction();
@@ -174,6 +273,7 @@ bool MSqlDatabase::transaction() {
 }
 
 bool  MSqlDatabase::commit() {
+    if(!isSingleConnection("commit")) return false;
     QString connectionName = m_connectionName;
     return CallByWorker(workerForConnection(connectionName), [=]{
         return QSqlDatabase::database(connectionName, false).commit();
@@ -181,12 +281,23 @@ bool  MSqlDatabase::commit() {
 }
 
 bool MSqlDatabase::rollback() {
+    if(!isSingleConnection("rollback")) return false;
     QString connectionName = m_connectionName;
     return CallByWorker(workerForConnection(connectionName), [=]{
         return QSqlDatabase::database(connectionName, false).rollback();
     });
 }
 
+bool MSqlDatabase::isSingleConnection(const char *function) const {
+    //statements executed by MSqlQuery objects may run on any connection of the pool,
+    //so a transaction started on one of them would not cover them
+    int connectionCount = poolSize();
+    if(connectionCount <= 1) return true;
+    qWarning("MSqlDatabase::%s: not supported on a pool of %d connections, use MSqlTransaction instead",
+             function, connectionCount);
+    return false;
+}
+
 QSqlError MSqlDatabase::lastError()const {
     QString connectionName = m_connectionName;
     return CallByWorker(workerForConnection(connectionName), [=]{
@@ -195,16 +306,20 @@ QSqlError MSqlDatabase::lastError()const {
 }
 
 bool MSqlDatabase::open() {
-    QString connectionName = m_connectionName;
-    return CallByWorker(workerForConnection(connectionName), [=]{
-        return QSqlDatabase::database(connectionName, false).open();
+    return CallByConnections(connectionsForName(m_connectionName), [](MSqlConnection* connection, QSqlDatabase db){
+        bool isOpen = db.open();
+        connection->updateNativeHandle(db);
+        return isOpen;
     });
 }
 
 void MSqlDatabase::close() {
-    QString connectionName = m_connectionName;
-    CallByWorker(workerForConnection(connectionName), [=]{
-        QSqlDatabase::database(connectionName, false).close();
+    CallByConnections(connectionsForName(m_connectionName), [](MSqlConnection* connection, QSqlDatabase db){
+        //prepared statements are invalidated when the connection is closed
+        connection->statementCache()->clear();
+        db.close();
+        connection->updateNativeHandle(db);
+        return true;
     });
 }
 
@@ -232,7 +347,20 @@ bool MSqlDatabase::isValid()const {
 bool MSqlDatabase::subscribeToNotification(const QString &name) {
     QString connectionName = m_connectionName;
     return CallByWorker(workerForConnection(connectionName), [=]{
-        return QSqlDatabase::database(connectionName, false).driver()->subscribeToNotification(name);
+        QSqlDriver* driver = QSqlDatabase::database(connectionName, false).driver();
+        if(!driver->property("_msqlquery_resultCacheConnected").toBool()) {
+            driver->setProperty("_msqlquery_resultCacheConnected", true);
+            //notifications invalidate the cached results tagged with their name
+            //the cache is looked up when the notification arrives, as it can be enabled/disabled at any time
+            QObject::connect(driver, static_cast<void (QSqlDriver::*)(const QString&, QSqlDriver::NotificationSource,
+                                                                      const QVariant&)>(&QSqlDriver::notification),
+                             [=](const QString& notification){
+                QSharedPointer<MSqlResultCache> resultCache = resultCacheForName(connectionName);
+                if(resultCache)
+                    resultCache->invalidate(notification);
+            });
+        }
+        return driver->subscribeToNotification(name);
     });
 }
 
@@ -257,12 +385,211 @@ const QSqlDriver *MSqlDatabase::driver() {
     });
 }
 
-MSqlThread* MSqlDatabase::threadForConnection(QString connectionName) {
+QObject* MSqlDatabase::connectionContext() const {
+    return workerForConnection(m_connectionName);
+}
+
+void MSqlDatabase::setStatementCacheCapacity(int capacity) {
+    for(MSqlConnection* connection : connectionsForName(m_connectionName))
+        connection->statementCache()->setCapacity(capacity);
+}
+
+int MSqlDatabase::statementCacheCapacity() const {
+    QList<MSqlConnection*> pool = connectionsForName(m_connectionName);
+    if(pool.isEmpty()) return 0;
+    return pool.first()->statementCache()->capacity();
+}
+
+int MSqlDatabase::statementCacheHits() const {
+    int hits = 0;
+    for(MSqlConnection* connection : connectionsForName(m_connectionName))
+        hits += connection->statementCache()->hitCount();
+    return hits;
+}
+
+int MSqlDatabase::statementCacheMisses() const {
+    int misses = 0;
+    for(MSqlConnection* connection : connectionsForName(m_connectionName))
+        misses += connection->statementCache()->missCount();
+    return misses;
+}
+
+void MSqlDatabase::enableResultCache(int maxEntries, int ttlMsecs) {
     MSqlConnections* connections = getMSqlConnections();
-    QReadLocker locker(&connections->lock);
-    return connections->dict.value(connectionName, nullptr);
+    MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    connections->resultCaches.insert(m_connectionName, QSharedPointer<MSqlResultCache>(
+                                         new MSqlResultCache(maxEntries, ttlMsecs)));
+}
+
+void MSqlDatabase::disableResultCache() {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingWriteLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    connections->resultCaches.remove(m_connectionName);
+}
+
+bool MSqlDatabase::isResultCacheEnabled() const {
+    return !resultCacheForName(m_connectionName).isNull();
+}
+
+void MSqlDatabase::invalidateResultCache(const QString &tag) {
+    QSharedPointer<MSqlResultCache> resultCache = resultCacheForName(m_connectionName);
+    if(resultCache)
+        resultCache->invalidate(tag);
+}
+
+void MSqlDatabase::clearResultCache() {
+    QSharedPointer<MSqlResultCache> resultCache = resultCacheForName(m_connectionName);
+    if(resultCache)
+        resultCache->clear();
+}
+
+void MSqlDatabase::setSlowQueryThreshold(int msecs) {
+    QList<MSqlConnection*> connections = connectionsForName(m_connectionName);
+    if(!connections.isEmpty())
+        connections.first()->slowQueryLog()->setThreshold(msecs);
+}
+
+int MSqlDatabase::slowQueryThreshold() const {
+    QList<MSqlConnection*> connections = connectionsForName(m_connectionName);
+    return connections.isEmpty() ? -1 : connections.first()->slowQueryLog()->threshold();
+}
+
+void MSqlDatabase::setSlowQueryLogFile(const QString &fileName, qint64 maxBytes, int maxFiles) {
+    QList<MSqlConnection*> connections = connectionsForName(m_connectionName);
+    if(!connections.isEmpty())
+        connections.first()->slowQueryLog()->setLogFile(fileName, maxBytes, maxFiles);
+}
+
+void MSqlDatabase::setSlowQueryCallback(const std::function<void (const MSqlSlowQuery &)> &callback) {
+    QList<MSqlConnection*> connections = connectionsForName(m_connectionName);
+    if(!connections.isEmpty())
+        connections.first()->slowQueryLog()->setCallback(callback);
+}
+
+void MSqlDatabase::setSlowQueryPlanCapture(bool enabled) {
+    QList<MSqlConnection*> connections = connectionsForName(m_connectionName);
+    if(!connections.isEmpty())
+        connections.first()->slowQueryLog()->setPlanCapture(enabled);
+}
+
+QList<MSqlConnectionStatistics> MSqlDatabase::statistics() const {
+    QList<MSqlConnectionStatistics> statistics;
+    for(MSqlConnection* connection : connectionsForName(m_connectionName)) {
+        MSqlConnectionStatistics connectionStatistics = connection->statistics()->snapshot();
+        connectionStatistics.queueDepth = connection->thread()->load();
+        statistics.append(connectionStatistics);
+    }
+    return statistics;
+}
+
+int MSqlDatabase::connectionsLockContentions() {
+    return MSqlContention::connectionsLock.load();
+}
+
+int MSqlDatabase::workerLockContentions() {
+    return MSqlContention::workerLock.load();
+}
+
+int MSqlDatabase::poolSize() const {
+    return connectionsForName(m_connectionName).size();
+}
+
+bool MSqlDatabase::isRouted() const {
+    return readerCount() > 0;
+}
+
+int MSqlDatabase::readerCount() const {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    return connections->readerCounts.value(m_connectionName);
+}
+
+MSqlConnection* MSqlDatabase::connectionForQuery(QString connectionName) {
+    QList<MSqlConnection*> pool;
+    bool isRouted;
+    {
+        MSqlConnections* connections = getMSqlConnections();
+        MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+        Q_UNUSED(locker)
+        pool = connections->dict.value(connectionName);
+        isRouted = connections->readerCounts.contains(connectionName);
+    }
+    if(isRouted) //writes (and queries that may write) go to the writer
+        return pool.first();
+    return leastLoadedConnection(pool);
+}
+
+QList<MSqlConnection*> MSqlDatabase::readersForName(QString connectionName) {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    if(!connections->readerCounts.contains(connectionName))
+        return QList<MSqlConnection*>();
+    return connections->dict.value(connectionName).mid(1);
+}
+
+MSqlConnection* MSqlDatabase::leastLoadedConnection(const QList<MSqlConnection*>& connections) {
+    MSqlConnection* leastLoaded = nullptr;
+    for(MSqlConnection* connection : connections) {
+        if(!leastLoaded) {
+            leastLoaded = connection;
+            continue;
+        }
+        //prefer the thread with fewer queued queries, then the one serving fewer query objects
+        MSqlThread* thread = connection->thread();
+        MSqlThread* leastLoadedThread = leastLoaded->thread();
+        if(thread->load() < leastLoadedThread->load() ||
+                (thread->load() == leastLoadedThread->load() &&
+                 thread->workerCount() < leastLoadedThread->workerCount()))
+            leastLoaded = connection;
+    }
+    return leastLoaded;
+}
+
+QSharedPointer<MSqlResultCache> MSqlDatabase::resultCacheForName(QString connectionName) {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    return connections->resultCaches.value(connectionName);
+}
+
+QList<MSqlConnection*> MSqlDatabase::connectionsForName(QString connectionName) {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    return connections->dict.value(connectionName);
+}
+
+int MSqlDatabase::connectionIndexForQuery(QString connectionName) {
+    return connectionsForName(connectionName).indexOf(connectionForQuery(connectionName));
+}
+
+bool MSqlDatabase::postToConnection(QString connectionName, int index, MSqlPriority::Priority priority,
+                                    const std::function<void (MSqlConnection *)> &job) {
+    MSqlConnections* connections = getMSqlConnections();
+    MSqlCountingReadLocker locker(&connections->lock, &MSqlContention::connectionsLock);
+    Q_UNUSED(locker)
+    MSqlConnection* connection = connections->dict.value(connectionName).value(index);
+    if(!connection) return false;
+    connection->thread()->postJob(connection->getWorker(), priority, [=]{
+        job(connection);
+    });
+    return true;
+}
+
+QSqlError MSqlDatabase::noConnectionError(QString connectionName) {
+    return QSqlError(QString(), QStringLiteral("there is no connection named %0").arg(connectionName),
+                     QSqlError::ConnectionError);
 }
 
 QObject* MSqlDatabase::workerForConnection(QString connectionName) {
-    return threadForConnection(connectionName)->getWorker();
+    QList<MSqlConnection*> pool = connectionsForName(connectionName);
+    if(pool.isEmpty()) { //calls posted to the null worker fail (with Qt warnings), and return default values
+        qWarning("MSqlDatabase: there is no connection named %s", qPrintable(connectionName));
+        return nullptr;
+    }
+    return pool.first()->getWorker();
 }
@@ -1,19 +1,54 @@
 #ifndef MSQLDATABASE_H
 #define MSQLDATABASE_H
 #include <QString>
+#include <QList>
 #include <QSqlError>
+#include <QSharedPointer>
+#include "msqlstatistics.h"
+#include "msqlpriority.h"
+#include <functional>
 
 class QSqlDriver;
 class QObject;
+class MSqlConnection;
 class MSqlThread;
+class MSqlResultCache;
+struct MSqlSlowQuery;
 
 class MSqlDatabase //provides an interface similar to QSqlDatabase except that all connections are created in the MDbThread
 {
 public:
     friend class MSqlQuery;
+    friend class MSqlTransaction;
+    friend class MSqlWriteBuffer;
+    friend class MSqlBulkLoader;
     ~MSqlDatabase();
-    static MSqlDatabase addDatabase(const QString& type, const QString& connectionName = defaultConnectionName);
+    //adding a connection name that already exists replaces its connections, the workers of MSqlQuery objects using
+    //them are destroyed with them (after the jobs already queued on them have run), and the MSqlQuery objects
+    //move to the new connections on their next query, even if they are used from other threads meanwhile
+    //poolSize is the number of connections (each with its own thread) opened with the same settings under connectionName
+    //MSqlQuery objects are assigned to the least-loaded connection in the pool, so they can execute in parallel
+    //note: transaction(), commit() and rollback() fail (return false) when the pool has more than one connection,
+    //as the queries of the transaction could run on any of them, use MSqlTransaction instead
+    static MSqlDatabase addDatabase(const QString& type, const QString& connectionName = defaultConnectionName, int poolSize = 1);
+    //adds a routed group: a writer connection followed by readerCount reader connections (each with its own thread),
+    //all opened with the same settings under connectionName
+    //MSqlQuery sends SELECT statements and queries marked as read-only (see MSqlQuery::setReadOnly) to the least-loaded
+    //reader, and all other queries to the writer, so that long reads do not delay writes (and the other way around)
+    //MSqlTransaction, MSqlWriteBuffer, MSqlBulkLoader, and all the functions of this class that act on a single
+    //connection use the writer (except transaction(), commit() and rollback(), which fail, see addDatabase)
+    //note: for SQLite, readers can only run in parallel with the writer if the database is a file in WAL mode
+    //(PRAGMA journal_mode=WAL), reads may not see writes that are not committed yet
+    static MSqlDatabase addRoutedDatabase(const QString& type, int readerCount, const QString& connectionName = defaultConnectionName);
     static MSqlDatabase database(const QString& connectionName = defaultConnectionName);
+    //by default, every connection (including every connection in a pool or a routed group) starts its own thread
+    //when count > 0, connections added afterwards are pinned to one of up to count shared threads instead (the one
+    //serving the fewest connections, then the one with the fewest queued queries), so that the number of threads
+    //stops growing with the number of connections. a connection is still only used from the thread it was created in
+    //note that queries on connections sharing a thread are executed one at a time (see MSqlPriority for their order),
+    //shared threads keep running until the application exits. set count to 0 to go back to dedicated threads
+    static void setSharedThreadCount(int count);
+    static int sharedThreadCount();
     
     void setHostName(const QString& host);
     void setDatabaseName(const QString& name);
@@ -23,6 +58,10 @@ public:
     void setPort(int port);
     
     QString connectionName()const{return m_connectionName;}
+    int poolSize()const;
+    bool isRouted()const;
+    //the number of reader connections in a routed group, 0 if the connection is not routed
+    int readerCount()const;
     //warning: all the following functions block the calling thread
     QString hostName();
     QString databaseName();
@@ -43,6 +82,32 @@ public:
     //you can only connect signals from here, do not call any functions on the returned QSqlDriver directly
     //as this has to be done from the database thread
     const QSqlDriver* driver(); 
+    
+    //returns an object living in the connection's thread (the first connection's thread in a pool)
+    //it can be used as the context object passed to MSqlThen() to run continuations in the connection's thread
+    //do NOT delete the returned object, or change its thread affinity
+    QObject* connectionContext()const;
+    //prepared statement cache
+    //every connection caches up to capacity prepared statements (keyed by their SQL text), so that repeated
+    //statements are not prepared again, the least recently used statements are evicted first
+    //set the capacity to 0 to disable the cache. the cache is cleared when the connection is closed
+    void setStatementCacheCapacity(int capacity);
+    int statementCacheCapacity()const;
+    //the number of executions that found (hits) or did not find (misses) their statement in the cache,
+    //summed over all connections in the pool
+    int statementCacheHits()const;
+    int statementCacheMisses()const;
+    //result cache
+    //when enabled, the results of queries that opt in (see MSqlQuery::setResultCaching) are cached and shared
+    //by all MSqlQuery objects using this connection name, a cached result is delivered without using the connection
+    //results expire after ttlMsecs (never if ttlMsecs <= 0), and the least recently used ones are evicted first
+    //a notification (see subscribeToNotification) invalidates the results tagged with the notification's name
+    void enableResultCache(int maxEntries = 256, int ttlMsecs = 60000);
+    void disableResultCache();
+    bool isResultCacheEnabled()const;
+    //removes the cached results tagged with the given tag (eg. after writing to a table)
+    void invalidateResultCache(const QString& tag);
+    void clearResultCache();
     //use the following functions to subscribe/unsubscribe to/from notifications
     //do NOT call the corresponding functions on the QSqlDriver object yourself
     bool subscribeToNotification(const QString & name);
@@ -50,12 +115,60 @@ public:
     bool unsubscribeFromNotification(const QString& name);
     
     
+    //slow query log
+    //statements executed by MSqlQuery that take at least msecs (to execute and fetch, excluding the time spent
+    //in the queue) are logged with their binds, row count, phase timings and plan (see MSqlSlowQuery)
+    //the plan is captured in the connection's thread, after the query's results have been delivered
+    //a negative threshold (the default) disables the log
+    void setSlowQueryThreshold(int msecs);
+    int slowQueryThreshold()const;
+    //entries are appended to fileName, which is rotated when it grows beyond maxBytes (see MSqlSlowQueryLog::setLogFile)
+    void setSlowQueryLogFile(const QString& fileName, qint64 maxBytes = 10*1024*1024, int maxFiles = 5);
+    //the callback is called from the connection's thread, include msqlslowquerylog.h to use MSqlSlowQuery
+    void setSlowQueryCallback(const std::function<void(const MSqlSlowQuery&)>& callback);
+    //enabled by default, currently supported for SQLite, PostgreSQL and MySQL connections
+    void setSlowQueryPlanCapture(bool enabled);
+
+    //returns the statistics of every connection in the pool (in the pool's order), thread-safe
+    //statistics are always collected, reading them never blocks the connections' threads
+    QList<MSqlConnectionStatistics> statistics()const;
+
+    //lock contention counters: the number of times (since the start of the process) a thread had to wait
+    //for the lock guarding the registry of connections, or for the lock guarding a query worker's running query
+    static int connectionsLockContentions();
+    static int workerLockContentions();
+
     bool isOpen()const;
     bool isOpenError()const;
     bool isValid()const;
     static const QString defaultConnectionName;
 private:
-    static MSqlThread* threadForConnection(QString connectionName);
+    //returns false (with a warning mentioning function) if the connection name maps to more than one connection
+    bool isSingleConnection(const char* function)const;
+    static MSqlDatabase addPool(const QString& type, const QString& connectionName, int poolSize, int readerCount);
+    //returns the shared thread the next connection should be pinned to, or a null pointer for a dedicated thread
+    //must be called with the connections' write lock held
+    static MSqlThread* sharedThreadForConnection();
+    //returns the least-loaded connection in the pool (the writer in a routed group),
+    //or a null pointer if the connection name has not been added
+    static MSqlConnection* connectionForQuery(QString connectionName);
+    static MSqlConnection* leastLoadedConnection(const QList<MSqlConnection*>& connections);
+    //returns the reader connections of a routed group, or an empty list if the connection is not routed
+    static QList<MSqlConnection*> readersForName(QString connectionName);
+    static QList<MSqlConnection*> connectionsForName(QString connectionName);
+    //returns the position in its pool of the connection returned by connectionForQuery(), or -1 if there is none
+    static int connectionIndexForQuery(QString connectionName);
+    //posts the job to the connection at index in the pool, the job is called with the connection in its thread
+    //the connection is looked up and the job is posted under the registry's lock, so the job is queued before
+    //the connection can be destroyed (its destructor runs the jobs queued before it, see ~MSqlConnection)
+    //returns false if there is no connection at index (eg. the pool has been replaced by a smaller one)
+    static bool postToConnection(QString connectionName, int index, MSqlPriority::Priority priority,
+                                 const std::function<void(MSqlConnection*)>& job);
+    //the error reported by jobs that cannot be posted to their connection
+    static QSqlError noConnectionError(QString connectionName);
+    //returns the connection's result cache, or a null pointer if the cache is disabled
+    static QSharedPointer<MSqlResultCache> resultCacheForName(QString connectionName);
+    //returns the worker of the first connection in the pool, or a null pointer (with a warning) if there is none
     static QObject* workerForConnection(QString connectionName);
     MSqlDatabase();
     QString m_connectionName;
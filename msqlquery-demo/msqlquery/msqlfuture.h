@@ -0,0 +1,93 @@
+#ifndef MSQLFUTURE_H
+#define MSQLFUTURE_H
+
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include "qthreadutils.h"
+#include "msqlresult.h"
+
+//helpers used to chain continuations on QFuture objects returned by the *Async() functions
+//(QFuture in Qt5 does not support continuations)
+
+namespace MSqlFuturePrivate {
+//calls the continuation with the result of the future (or without arguments for QFuture<void>),
+//and reports the continuation's return value (if any) to the continuation's future
+template <typename T, typename R>
+struct Continuation {
+    template <typename Func>
+    static void run(const QFuture<T>& future, const Func& f, QFutureInterface<R>& resultInterface) {
+        resultInterface.reportResult(f(future.result()));
+    }
+};
+template <typename T>
+struct Continuation<T, void> {
+    template <typename Func>
+    static void run(const QFuture<T>& future, const Func& f, QFutureInterface<void>&) {
+        f(future.result());
+    }
+};
+template <typename R>
+struct Continuation<void, R> {
+    template <typename Func>
+    static void run(const QFuture<void>&, const Func& f, QFutureInterface<R>& resultInterface) {
+        resultInterface.reportResult(f());
+    }
+};
+template <>
+struct Continuation<void, void> {
+    template <typename Func>
+    static void run(const QFuture<void>&, const Func& f, QFutureInterface<void>&) {
+        f();
+    }
+};
+} // namespace MSqlFuturePrivate
+
+//calls the functor with the result of the future when the future finishes
+//the functor is called in the thread of the context object, pass:
+// - the calling object (eg. this) to run the continuation in the caller's thread
+// - MSqlDatabase::connectionContext() to run the continuation in the database connection's thread
+//the returned future reports the functor's return value, so that continuations can be chained
+//if the future is canceled (eg. the query was overwritten by another one) or the context object
+//is destroyed, the functor is not called, and the returned future is canceled
+//
+//example:
+//  MSqlThen(query->execAsync(), this, [=](const MSqlResult& result){ return result.rowCount(); });
+template <typename T, typename Func>
+QFuture<typename FunctorTraits<Func>::return_t> MSqlThen(const QFuture<T>& future, QObject* context, Func f) {
+    typedef typename FunctorTraits<Func>::return_t R;
+    QFutureInterface<R> resultInterface;
+    resultInterface.reportStarted();
+    //the returned future is settled once, either by the continuation or by the destruction of the context
+    QSharedPointer<QAtomicInt> isSettled(new QAtomicInt(0));
+    QSharedPointer<QMetaObject::Connection> contextConnection(new QMetaObject::Connection);
+    //connected before posting, as the posted call below is dropped if the context is destroyed before it runs
+    *contextConnection = QObject::connect(context, &QObject::destroyed, [=]{
+        if(!isSettled->testAndSetOrdered(0, 1)) return;
+        QFutureInterface<R> continuationInterface = resultInterface;
+        continuationInterface.reportCanceled();
+        continuationInterface.reportFinished();
+    });
+    PostToWorker(context, [=]{
+        //the watcher lives in the context's thread, and gets destroyed with the context
+        auto watcher = new QFutureWatcher<T>(context);
+        QObject::connect(watcher, &QFutureWatcherBase::finished, watcher, [=]{
+            watcher->deleteLater();
+            //the context outlives the continuation, the connection is not needed anymore
+            QObject::disconnect(*contextConnection);
+            if(!isSettled->testAndSetOrdered(0, 1)) return;
+            QFutureInterface<R> continuationInterface = resultInterface;
+            if(future.isCanceled())
+                continuationInterface.reportCanceled();
+            else
+                MSqlFuturePrivate::Continuation<T, R>::run(future, f, continuationInterface);
+            continuationInterface.reportFinished();
+        });
+        watcher->setFuture(future);
+    });
+    return resultInterface.future();
+}
+
+#endif // MSQLFUTURE_H
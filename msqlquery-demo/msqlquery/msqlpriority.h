@@ -0,0 +1,18 @@
+#ifndef MSQLPRIORITY_H
+#define MSQLPRIORITY_H
+
+//the priority of work executed in a connection's thread (see MSqlQuery::setPriority)
+//the connection's thread always runs the queued job with the highest priority first, a job that has been waiting
+//is raised by one priority level every MSqlThread::agingInterval msecs, so that lower priority jobs still make progress
+namespace MSqlPriority {
+enum Priority {
+    //bulk work that can wait (MSqlWriteBuffer batches, MSqlBulkLoader chunks)
+    Background,
+    //the default priority of queries and transactions
+    Normal,
+    //queries a user is waiting for (eg. the queries filling a view)
+    Interactive
+};
+}
+
+#endif // MSQLPRIORITY_H
@@ -1,96 +1,411 @@
 #include "msqlquery.h"
 #include "qthreadutils.h"
 #include "msqlthread.h"
+#include "msqlconnection.h"
+#include "msqlstatementcache.h"
+#include "msqlstatistics.h"
+#include "msqlresultcache.h"
+#include "msqlsingleflight.h"
+#include "msqlcontention.h"
 #include "msqldatabase.h"
-#include <QMutexLocker>
+#include "msqltracer.h"
+#include "msqlslowquerylog.h"
 #include <QSqlQuery>
+#include <QSqlDatabase>
+#include <QDataStream>
+#include <QFutureWatcher>
+#include <QPair>
 
 MSqlQuery::MSqlQuery(QObject *parent, MSqlDatabase db)
     : QObject(parent), db(db) {
-    w= new MSqlQueryWorker();
+    //needed to deliver results from the worker's thread through queued connections
+    static const int resultTypeId = qRegisterMetaType<MSqlResult>("MSqlResult");
+    Q_UNUSED(resultTypeId)
+    static const int timingsTypeId = qRegisterMetaType<MSqlQueryTimings>("MSqlQueryTimings");
+    Q_UNUSED(timingsTypeId)
+    //in a connection pool, the worker is assigned to the least-loaded connection
+    //in a routed group, it is assigned to the writer, reads get their own workers when needed (see routeQuery)
+    w = createWorker(MSqlDatabase::connectionForQuery(db.connectionName()));
+    m_lastWorker = w;
+}
+
+MSqlQuery::~MSqlQuery() {
+    cancelFutures();
+    for(const QSharedPointer<MSqlWorkerRef>& ref : workers()) {
+        MSqlWorkerLocker locker(ref);
+        MSqlQueryWorker* worker = locker.worker();
+        if(!worker) continue; //destroyed with its connection
+        worker->supersede(currentQueryId+1); //cancel queued queries if any
+        worker->interruptSuperseded(); //and the running one
+        InvokeLater(worker, &QObject::deleteLater);
+    }
+}
+
+MSqlWorkerLocker::MSqlWorkerLocker(const QSharedPointer<MSqlWorkerRef> &ref)
+    : m_ref(ref), m_locker(ref ? &ref->mutex : nullptr) {
+}
+
+MSqlQueryWorker *MSqlWorkerLocker::worker() const {
+    return m_ref ? static_cast<MSqlQueryWorker*>(m_ref->worker) : nullptr;
+}
+
+//returns false if the worker has been destroyed with its connection
+static bool isAttached(const QSharedPointer<MSqlWorkerRef>& ref) {
+    MSqlWorkerLocker locker(ref);
+    return locker.worker();
+}
+
+QSharedPointer<MSqlWorkerRef> MSqlQuery::createWorker(MSqlConnection *connection) {
+    if(!connection) { //the connection name has not been added (see MSqlDatabase::addDatabase)
+        qWarning("MSqlQuery: there is no connection named %s", qPrintable(db.connectionName()));
+        return QSharedPointer<MSqlWorkerRef>();
+    }
+    MSqlQueryWorker* w= new MSqlQueryWorker(connection);
     //connect func from worker to this instance's signal
     //this will make the signal get emitted from the MSqlQuery thread (instead of the worker thread)
     connect(w, &MSqlQueryWorker::resultsReady, this, &MSqlQuery::workerFinished);
-    w->moveToThread(MSqlDatabase::threadForConnection(db.connectionName()));
+    connect(w, &MSqlQueryWorker::rowsAvailable, this, &MSqlQuery::workerRowsAvailable);
+    w->moveToThread(connection->thread());
     //guarantee destruction of worker even when its life time does not end before thread destruction
-    connect(MSqlDatabase::threadForConnection(db.connectionName()), &MSqlThread::finished, w, &QObject::deleteLater);
-    auto w= this->w; //in order to capture w by value
-    //   ^^^^^^^^^^ is there a better way to do this without using c++14 initializing capture??
-    PostToWorker(w, [=]{
-        QSqlDatabase qdb = QSqlDatabase::database(db.connectionName());
-        w->q = new QSqlQuery(qdb);
-    });
+    connect(connection->thread(), &MSqlThread::finished, w, &QObject::deleteLater);
+    return w->ref();
+}
+
+QList<QSharedPointer<MSqlWorkerRef>> MSqlQuery::workers() const {
+    QList<QSharedPointer<MSqlWorkerRef>> workers;
+    workers.append(w);
+    workers.append(m_readerWorkers.values());
+    return workers;
+}
+
+bool MSqlQuery::isReadQuery(const MSqlQueryExec &query) const {
+    if(m_isReadOnly) return true;
+    if(query.isBatch) return false;
+    //the statement is a read if its first keyword is SELECT (skipping whitespace and opening parentheses)
+    const QString& sql = query.prepareStr;
+    int i = 0;
+    while(i < sql.size() && (sql.at(i).isSpace() || sql.at(i) == '(')) i++;
+    return sql.midRef(i, 6).compare(QLatin1String("select"), Qt::CaseInsensitive) == 0
+            && (i+6 == sql.size() || !(sql.at(i+6).isLetterOrNumber() || sql.at(i+6) == '_'));
+}
+
+QSharedPointer<MSqlWorkerRef> MSqlQuery::routeQuery(const MSqlQueryExec &query) {
+    if(!isAttached(w)) //the connection has been replaced (see MSqlDatabase::addDatabase), the query moves to the new one
+        w = createWorker(MSqlDatabase::connectionForQuery(db.connectionName()));
+    QSharedPointer<MSqlWorkerRef> worker = w;
+    QList<MSqlConnection*> readers;
+    if(isReadQuery(query))
+        readers = MSqlDatabase::readersForName(db.connectionName());
+    if(!readers.isEmpty()) {
+        //drop the workers of readers that have been removed (when the group has been replaced)
+        for(auto i = m_readerWorkers.begin(); i != m_readerWorkers.end();) {
+            if(!readers.contains(i.key()) || !isAttached(i.value()))
+                i = m_readerWorkers.erase(i);
+            else
+                ++i;
+        }
+        MSqlConnection* reader = MSqlDatabase::leastLoadedConnection(readers);
+        worker = m_readerWorkers.value(reader);
+        if(!worker) {
+            worker = createWorker(reader);
+            m_readerWorkers.insert(reader, worker);
+        }
+    }
+    if(!query.isPipelined) { //the query overwrites previous ones, even if they have been sent to other connections
+        for(const QSharedPointer<MSqlWorkerRef>& ref : workers()) {
+            if(ref == worker) continue;
+            MSqlWorkerLocker locker(ref);
+            if(MSqlQueryWorker* other = locker.worker()) {
+                other->supersede(query.queryId);
+                other->interruptSuperseded();
+            }
+        }
+    }
+    m_lastWorker = worker;
+    return worker;
+}
+
+void MSqlQuery::submitQuery(const MSqlQueryExec &query) {
+    //the worker can be destroyed with its connection right after the query has been routed, it is routed again then
+    forever {
+        QSharedPointer<MSqlWorkerRef> ref = routeQuery(query);
+        if(!ref) { //there is no connection to execute the query
+            if(!query.flightKey.isEmpty())
+                MSqlSingleFlight::abandon(query.flightKey);
+            deliverLater(query.queryId, noConnectionResult(), query.submittedAt);
+            return;
+        }
+        MSqlWorkerLocker locker(ref);
+        if(MSqlQueryWorker* worker = locker.worker()) {
+            worker->execAsync(query);
+            return;
+        }
+    }
 }
 
-MSqlQuery::~MSqlQuery() {
-    w->setNextQueryReady(false); //cancel next query if any
-    InvokeLater(w, &QObject::deleteLater);
+MSqlResult MSqlQuery::noConnectionResult() const {
+    MSqlResultBuilder builder((QSqlRecord()));
+    builder.setLastError(MSqlDatabase::noConnectionError(db.connectionName()));
+    return builder.take();
 }
 
 void MSqlQuery::prepare(const QString &query) {
-    w->prepare(query);
+    m_nextQuery.placeHolderBinds.clear();
+    m_nextQuery.positionalBinds.clear();
+    m_nextQuery.positionalBindIndex = 0;
+    m_nextQuery.prepareStr = query;
 }
 
 void MSqlQuery::addBindValue(const QVariant &val, QSql::ParamType paramType) {
-    w->addBindValue(val, paramType);
+    //like QSqlQuery, values added after a query is executed overwrite the previous ones (starting from the first one)
+    MSqlQueryExec::PositionalBind bind = std::make_tuple(val, paramType);
+    if(m_nextQuery.positionalBindIndex < m_nextQuery.positionalBinds.size())
+        m_nextQuery.positionalBinds[m_nextQuery.positionalBindIndex] = bind;
+    else
+        m_nextQuery.positionalBinds.append(bind);
+    m_nextQuery.positionalBindIndex++;
 }
 
 void MSqlQuery::bindValue(const QString &placeholder, const QVariant &val, QSql::ParamType paramType) {
-    w->bindValue(placeholder, val, paramType);
+    //like QSqlQuery, binding a placeholder again replaces its previous value
+    MSqlQueryExec::PlaceHolderBind bind = std::make_tuple(placeholder, val, paramType);
+    for(MSqlQueryExec::PlaceHolderBind& existing : m_nextQuery.placeHolderBinds) {
+        if(std::get<0>(existing) == placeholder) {
+            existing = bind;
+            return;
+        }
+    }
+    m_nextQuery.placeHolderBinds.append(bind);
 }
 
-void MSqlQuery::execAsync(const QString &query) {
-    w->prepare(query);
-    execAsync();
+QFuture<MSqlResult> MSqlQuery::execAsync(const QString &query) {
+    prepare(query);
+    return execAsync();
 }
 
-void MSqlQuery::execAsync()
+QFuture<MSqlResult> MSqlQuery::execAsync()
 {
-    w->execAsync(++currentQueryId);
-    m_isBusy = true;
-    emit busyToggled(true);
+    //only the results of queries that are not streamed can be cached or shared
+    bool isShareable = m_chunkSize == 0;
+    bool isSingleFlight = isShareable && m_isSingleFlight;
+    QSharedPointer<MSqlResultCache> resultCache;
+    if(isShareable && m_isResultCaching)
+        resultCache = MSqlDatabase::resultCacheForName(db.connectionName());
+    QByteArray key;
+    if(resultCache || isSingleFlight)
+        key = nextQueryCacheKey();
+    MSqlResult cachedResult;
+    if(resultCache && resultCache->lookup(key, &cachedResult)) {
+        QFuture<MSqlResult> future = beginAsyncExec();
+        m_isCursorLazy = false;
+        m_nextQuery.positionalBindIndex = 0; //as if the query has been submitted
+        supersedeWorkerQuery(currentQueryId);
+        //the result is delivered without using the connection
+        deliverLater(currentQueryId, cachedResult, m_isTimingEnabled ? MSqlQueryTimings::now() : 0);
+        return future;
+    }
+    MSqlTraceScope submitScope(true, "query", "execAsync", "query");
+    QFuture<MSqlResult> future = beginAsyncExec();
+    if(resultCache) {
+        PendingCacheInsert cacheInsert;
+        cacheInsert.cache = resultCache;
+        cacheInsert.key = key;
+        cacheInsert.generation = resultCache->generation();
+        m_pendingCacheInserts.insert(currentQueryId, cacheInsert);
+    }
+    //in pipelined mode, the cursor cannot be kept open as the next query in the pipeline reuses it
+    m_isCursorLazy = m_isLazyFetch && m_chunkSize > 0 && !m_isPipelined;
+    MSqlQueryExec query = takeNextQuery(false, QSqlQuery::ValuesAsRows, m_chunkSize, m_isCursorLazy);
+    if(query.traceId)
+        submitScope.startFlow(query.traceId);
+    if(isSingleFlight) {
+        QByteArray flightKey = db.connectionName().toUtf8() + '\0' + key;
+        bool isLeader;
+        QFuture<MSqlResult> flight = MSqlSingleFlight::join(flightKey, &isLeader);
+        if(!isLeader) { //an identical query is running, wait for its result
+            supersedeWorkerQuery(currentQueryId);
+            followFlight(query, flight);
+            return future;
+        }
+        query.flightKey = flightKey;
+    }
+    submitQuery(query);
+    return future;
 }
 
-void MSqlQuery::execBatchAsync(QSqlQuery::BatchExecutionMode mode) {
-    w->execAsync(++currentQueryId, true, mode);
-    m_isBusy = true;
-    emit busyToggled(true);
+QFuture<MSqlResult> MSqlQuery::execBatchAsync(QSqlQuery::BatchExecutionMode mode) {
+    QFuture<MSqlResult> future = beginAsyncExec();
+    MSqlQueryExec query = takeNextQuery(true, mode, 0, false);
+    submitQuery(query);
+    return future;
+}
+
+QFuture<MSqlResult> MSqlQuery::exportAsync(const QString &query, QIODevice *device, MSqlRowFormat::Format format, bool withHeader) {
+    prepare(query);
+    return exportAsync(device, format, withHeader);
+}
+
+QFuture<MSqlResult> MSqlQuery::exportAsync(QIODevice *device, MSqlRowFormat::Format format, bool withHeader) {
+    QFuture<MSqlResult> future = beginAsyncExec();
+    m_isCursorLazy = false;
+    MSqlQueryExec query = takeNextQuery(false, QSqlQuery::ValuesAsRows, 0, false);
+    query.exportDevice = device;
+    query.exportFormat = format;
+    query.isExportingHeader = withHeader;
+    submitQuery(query);
+    return future;
 }
 
 bool MSqlQuery::exec(const QString &query) {
-    w->prepare(query);
+    prepare(query);
     return exec();
 }
 
 bool MSqlQuery::exec() {
-    w->setNextQueryReady(true);
-    return execNextBlocking();
+    return execNextBlocking(false);
 }
 
 bool MSqlQuery::execBatch(QSqlQuery::BatchExecutionMode mode) {
-    w->setNextQueryReady(true, true, mode);
-    return execNextBlocking();
+    return execNextBlocking(true, mode);
 }
 
+//the cursor functions work on the last result snapshot, they never access the worker
 bool MSqlQuery::next() {
-    return w->next();
+    if(m_currentItem+1 >= m_result.rowCount()) return false;
+    m_currentItem++;
+    return true;
 }
 
 QSqlRecord MSqlQuery::record() const {
-    return w->record();
+    return m_result.record(m_currentItem);
+}
+
+QVariant MSqlQuery::value(int index) const {
+    return m_result.value(m_currentItem, index);
+}
+
+QVariant MSqlQuery::value(const QString &name) const {
+    return m_result.value(m_currentItem, name);
 }
 
 QSqlError MSqlQuery::lastError() const {
-    return w->lastError();
+    return m_result.lastError();
 }
 
 bool MSqlQuery::seek(int index)
 {
-    return w->seek(index);
+    if(index >= m_result.rowCount()) {
+        return false;
+    } else {
+        m_currentItem = index;
+        return true;
+    }
+}
+
+void MSqlQuery::setChunkSize(int rows) {
+    m_chunkSize = qMax(rows, 0);
+}
+
+int MSqlQuery::chunkSize() const {
+    return m_chunkSize;
+}
+
+void MSqlQuery::setLazyFetch(bool lazy) {
+    m_isLazyFetch = lazy;
+}
+
+bool MSqlQuery::isLazyFetch() const {
+    return m_isLazyFetch;
+}
+
+void MSqlQuery::setPipelined(bool pipelined) {
+    m_isPipelined = pipelined;
+}
+
+bool MSqlQuery::isPipelined() const {
+    return m_isPipelined;
+}
+
+int MSqlQuery::lastExecutionId() const {
+    return currentQueryId;
+}
+
+void MSqlQuery::cancel() {
+    cancelFutures();
+    for(const QSharedPointer<MSqlWorkerRef>& ref : workers()) {
+        MSqlWorkerLocker locker(ref);
+        if(MSqlQueryWorker* worker = locker.worker()) {
+            worker->supersede(currentQueryId+1);
+            worker->interruptSuperseded();
+        }
+    }
+    m_canFetchMore = false;
+    m_isFetching = false;
+    if(m_isBusy) {
+        m_isBusy = false;
+        emit busyToggled(false);
+    }
+}
+
+void MSqlQuery::setResultCaching(bool enabled, const QStringList &tags) {
+    m_isResultCaching = enabled;
+    m_resultCacheTags = tags;
+}
+
+bool MSqlQuery::isResultCaching() const {
+    return m_isResultCaching;
+}
+
+void MSqlQuery::setSingleFlight(bool enabled) {
+    m_isSingleFlight = enabled;
+}
+
+bool MSqlQuery::isSingleFlight() const {
+    return m_isSingleFlight;
+}
+
+void MSqlQuery::setPriority(MSqlPriority::Priority priority) {
+    m_priority = priority;
+}
+
+MSqlPriority::Priority MSqlQuery::priority() const {
+    return m_priority;
+}
+
+void MSqlQuery::setReadOnly(bool readOnly) {
+    m_isReadOnly = readOnly;
+}
+
+bool MSqlQuery::isReadOnly() const {
+    return m_isReadOnly;
+}
+
+void MSqlQuery::setTimingEnabled(bool enabled) {
+    m_isTimingEnabled = enabled;
+}
+
+bool MSqlQuery::isTimingEnabled() const {
+    return m_isTimingEnabled;
+}
+
+MSqlQueryTimings MSqlQuery::timings() const {
+    return m_timings;
+}
+
+bool MSqlQuery::canFetchMore() const {
+    return m_canFetchMore && !m_isFetching;
+}
+
+void MSqlQuery::fetchMoreAsync() {
+    if(!canFetchMore()) return;
+    MSqlWorkerLocker locker(m_lastWorker); //the worker keeping the lazy query's cursor
+    if(!locker.worker()) return; //it has been destroyed with its connection
+    m_isFetching = true;
+    locker.worker()->fetchMoreAsync(currentQueryId, m_priority);
 }
 
 QVariant MSqlQuery::lastInsertId() const {
-    return w->lastInsertId();
+    return m_result.lastInsertId();
 }
 
 bool MSqlQuery::isBusy() const {
@@ -98,178 +413,455 @@ bool MSqlQuery::isBusy() const {
 }
 
 QList<QSqlRecord> MSqlQuery::getAllRecords() const {
-    return w->getAllRecords();
+    return m_result.toRecordList();
 }
 
-void MSqlQuery::workerFinished(int queryId, bool success) {
-    if(queryId == currentQueryId) { //if this signal does not belong to an overwritten query
-        m_isBusy = false;
-        emit resultsReady(success);
+MSqlResult MSqlQuery::result() const {
+    return m_result;
+}
+
+void MSqlQuery::workerFinished(int queryId, bool success, const MSqlResult &result, const MSqlQueryTimings &timings) {
+    //only queries that have not been overwritten have pending futures
+    if(!m_futures.contains(queryId)) return;
+    MSqlTraceScope deliverScope(true, "query", "deliver results", "query", MSqlTracer::flowId(this, queryId));
+    QFutureInterface<MSqlResult> futureInterface = m_futures.take(queryId);
+    if(m_pendingCacheInserts.contains(queryId)) {
+        PendingCacheInsert cacheInsert = m_pendingCacheInserts.take(queryId);
+        if(success)
+            cacheInsert.cache->insert(cacheInsert.key, result, m_resultCacheTags, cacheInsert.generation);
+    }
+    m_result = result;
+    m_timings = timings;
+    if(m_timings.isValid())
+        m_timings.delivered = MSqlQueryTimings::now();
+    m_currentItem = -1; //before first item
+    futureInterface.reportResult(result);
+    futureInterface.reportFinished();
+    m_isBusy = !m_futures.isEmpty();
+    emit executionFinished(queryId, result);
+    emit resultsReady(success);
+    if(!m_isBusy)
         emit busyToggled(false);
+}
+
+void MSqlQuery::workerRowsAvailable(int queryId, const MSqlResult &rows, bool atEnd) {
+    //rows belong either to a pending query, or to the cursor of the last lazy query (fetched after it finished)
+    bool isCursorRows = m_isCursorLazy && queryId == currentQueryId;
+    if(!m_futures.contains(queryId) && !isCursorRows) return; //these rows belong to an overwritten query
+    m_isFetching = false;
+    m_canFetchMore = m_isCursorLazy && !atEnd;
+    if(!rows.isEmpty())
+        emit rowsAvailable(rows);
+}
+
+QFuture<MSqlResult> MSqlQuery::beginAsyncExec() {
+    currentQueryId++;
+    if(!m_isPipelined) { //previous queries are not interesting anymore
+        cancelFutures();
+        m_result = MSqlResult();
+        m_currentItem = -1;
+    }
+    QFutureInterface<MSqlResult> futureInterface;
+    futureInterface.reportStarted();
+    m_futures.insert(currentQueryId, futureInterface);
+    m_canFetchMore = false;
+    m_isFetching = false;
+    if(!m_isBusy) {
+        m_isBusy = true;
+        emit busyToggled(true);
     }
+    return futureInterface.future();
 }
 
-bool MSqlQuery::execNextBlocking() {
-    currentQueryId++; //previous queries are not interesting anymore
-    //block signals when using sync API ( blockSignals(true) is not thread-safe )
-    disconnect(w, &MSqlQueryWorker::resultsReady, this, &MSqlQuery::workerFinished);
-    auto w= this->w; //in order to capture w by value
-    CallByWorker(w, [=]{
-        w->execNextQuery();
+void MSqlQuery::cancelFutures() {
+    for(auto i = m_futures.begin(); i != m_futures.end(); ++i) {
+        i.value().reportCanceled();
+        i.value().reportFinished();
+    }
+    m_futures.clear();
+    m_pendingCacheInserts.clear();
+}
+
+QByteArray MSqlQuery::nextQueryCacheKey() const {
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << m_nextQuery.prepareStr << m_nextQuery.placeHolderBinds.size() << m_nextQuery.positionalBinds.size();
+    for(const auto& bind : m_nextQuery.placeHolderBinds)
+        stream << std::get<0>(bind) << std::get<1>(bind) << int(std::get<2>(bind));
+    for(const auto& bind : m_nextQuery.positionalBinds)
+        stream << std::get<0>(bind) << int(std::get<1>(bind));
+    return key;
+}
+
+void MSqlQuery::supersedeWorkerQuery(int queryId) {
+    if(m_isPipelined) return;
+    for(const QSharedPointer<MSqlWorkerRef>& ref : workers()) {
+        MSqlWorkerLocker locker(ref);
+        if(MSqlQueryWorker* worker = locker.worker()) {
+            worker->supersede(queryId);
+            worker->interruptSuperseded();
+        }
+    }
+}
+
+void MSqlQuery::deliverLater(int queryId, const MSqlResult &result, qint64 submittedAt) {
+    MSqlQueryTimings timings;
+    timings.submitted = submittedAt;
+    PostToWorker(this, [=]{
+        workerFinished(queryId, result.isSuccess(), result, timings);
     });
-    connect(w, &MSqlQueryWorker::resultsReady, this, &MSqlQuery::workerFinished);
-    bool success = w->lastError().type()==QSqlError::NoError;
-    return success;
 }
 
-MSqlQueryWorker::MSqlQueryWorker():QObject(nullptr) {
-    
+void MSqlQuery::followFlight(const MSqlQueryExec &query, const QFuture<MSqlResult> &flight) {
+    auto watcher = new QFutureWatcher<MSqlResult>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [=]{
+        watcher->deleteLater();
+        if(!m_futures.contains(query.queryId)) return; //the query has been overwritten or canceled
+        if(flight.isCanceled()) { //the leader has been canceled, the query is executed on its own
+            MSqlQueryExec ownQuery = query;
+            ownQuery.isPipelined = true; //it must not overwrite the queries submitted after it
+            submitQuery(ownQuery);
+            return;
+        }
+        MSqlResult result = flight.result();
+        MSqlQueryTimings timings;
+        timings.submitted = query.submittedAt;
+        workerFinished(query.queryId, result.isSuccess(), result, timings);
+    });
+    watcher->setFuture(flight);
+}
+
+MSqlQueryExec MSqlQuery::takeNextQuery(bool isBatch, QSqlQuery::BatchExecutionMode batchMode, int chunkSize, bool isLazy) {
+    MSqlQueryExec query = m_nextQuery;
+    query.queryId = currentQueryId;
+    query.isBatch = isBatch;
+    query.batchMode = batchMode;
+    query.chunkSize = chunkSize;
+    query.isLazy = isLazy;
+    query.isPipelined = m_isPipelined;
+    query.priority = m_priority;
+    query.submittedAt = m_isTimingEnabled ? MSqlQueryTimings::now() : 0;
+    query.traceId = MSqlTracer::isEnabled() ? MSqlTracer::flowId(this, query.queryId) : 0;
+    //binds added after this point overwrite the submitted ones
+    m_nextQuery.positionalBindIndex = 0;
+    return query;
+}
+
+bool MSqlQuery::execNextBlocking(bool isBatch, QSqlQuery::BatchExecutionMode batchMode) {
+    currentQueryId++; //previous queries are not interesting anymore
+    cancelFutures();
+    if(m_isBusy) {
+        m_isBusy = false;
+        emit busyToggled(false);
+    }
+    m_canFetchMore = false;
+    m_isFetching = false;
+    //blocking queries always store their results
+    MSqlQueryExec query = takeNextQuery(isBatch, batchMode, 0, false);
+    query.isPipelined = false; //blocking queries always overwrite previous ones
+    //the time this thread is blocked is recorded as a slice, linked to the query's phases in the connection's thread
+    MSqlTraceScope execScope(true, "query", "exec (blocking)", "query");
+    if(query.traceId)
+        execScope.startFlow(query.traceId);
+    QPair<MSqlResult, MSqlQueryTimings> finished;
+    forever {
+        QSharedPointer<MSqlWorkerRef> ref = routeQuery(query);
+        if(!ref) { //there is no connection to execute the query
+            finished.first = noConnectionResult();
+            break;
+        }
+        //the reference stays locked while waiting, so that the worker is not destroyed with its connection meanwhile
+        //(the connection clears the reference from the thread destroying it, not from the worker's thread)
+        MSqlWorkerLocker locker(ref);
+        MSqlQueryWorker* w = locker.worker(); //captured by value below
+        if(!w) continue; //destroyed with its connection after being routed, the query is routed again
+        w->enqueue(query);
+        w->connectionThread()->jobQueued();
+        //the resultsReady signal emitted by the worker is ignored, as the query has no pending future
+        finished = CallByWorker(w, [=]{
+            w->execNextQuery();
+            w->connectionThread()->jobFinished();
+            return qMakePair(w->lastResult(), w->lastTimings());
+        });
+        break;
+    }
+    m_result = finished.first;
+    m_timings = finished.second;
+    if(m_timings.isValid())
+        m_timings.delivered = MSqlQueryTimings::now();
+    m_currentItem = -1; //before first item
+    return m_result.isSuccess();
+}
+
+MSqlQueryWorker::MSqlQueryWorker(MSqlConnection *connection)
+    :QObject(nullptr), m_connection(connection), m_thread(connection->thread()),
+      m_statementCache(connection->statementCache()), m_statistics(connection->statistics()),
+      m_slowQueryLog(connection->slowQueryLog()) {
+    m_thread->workerAttached();
+    m_ref = m_connection->workerAttached(this);
 }
 
 MSqlQueryWorker::~MSqlQueryWorker() {
+    //abandon the flights of the queries that have not been executed
+    MSqlQueryExec query;
+    while(m_submissions.dequeue(query))
+        abandonFlight(query);
+    closeCursor();
     delete q;
+    m_thread->workerDetached();
+    m_connection->workerDetached(this);
 }
 
-void MSqlQueryWorker::prepare(const QString &query) {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    m_nextQuery.isReady = false;
-    m_nextQuery.placeHolderBinds.clear();
-    m_nextQuery.positionalBinds.clear();
-    m_nextQuery.prepareStr = query;
+void MSqlQueryWorker::enqueue(const MSqlQueryExec &query) {
+    m_submissions.enqueue(query);
+    if(!query.isPipelined) { //the query overwrites all previous ones
+        m_latestQueryId.storeRelease(query.queryId);
+        interruptSuperseded();
+    }
 }
 
-void MSqlQueryWorker::bindValue(const QString &placeholder, const QVariant &val, QSql::ParamType paramType) {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    m_nextQuery.isReady = false;
-    m_nextQuery.placeHolderBinds.append(std::make_tuple(placeholder, val, paramType));
+void MSqlQueryWorker::execAsync(const MSqlQueryExec &query) {
+    enqueue(query);
+    //the worker executes its queries in the order they have been queued, the priority of the query decides
+    //when the worker's next query runs relative to other jobs queued in the thread
+    m_thread->postJob(this, query.priority, [this]{
+        execNextQuery();
+    });
 }
 
-void MSqlQueryWorker::addBindValue(const QVariant &val, QSql::ParamType paramType) {
-    QMutexLocker locker(&mutex);
+void MSqlQueryWorker::supersede(int queryId) {
+    m_latestQueryId.storeRelease(queryId);
+}
+
+void MSqlQueryWorker::interruptSuperseded() {
+    MSqlCountingMutexLocker locker(&m_runningMutex, &MSqlContention::workerLock);
     Q_UNUSED(locker)
-    m_nextQuery.isReady = false;
-    m_nextQuery.positionalBinds.append(std::make_tuple(val, paramType));
+    //the interruption would also abort the lazy cursors left open on the connection by other workers
+    if(m_runningQueryId != -1 && isSuperseded(m_runningQueryId) && m_connection->openCursorCount() == 0)
+        m_connection->interrupt();
 }
 
-void MSqlQueryWorker::execAsync(int queryId, bool isBatch, QSqlQuery::BatchExecutionMode batchMode) {
-    QMutexLocker locker(&mutex);
+void MSqlQueryWorker::setRunningQueryId(int queryId) {
+    MSqlCountingMutexLocker locker(&m_runningMutex, &MSqlContention::workerLock);
     Q_UNUSED(locker)
-    m_nextQuery.isReady = true;
-    m_nextQuery.isBatch = isBatch;
-    m_nextQuery.batchMode = batchMode;
-    m_nextQuery.queryId = queryId;
-    m_records.clear();
-    m_currentItem = -1; //before first item
-    m_lastInsertId = QVariant();
-    m_lastError = QSqlError();
-    InvokeLater(this, &MSqlQueryWorker::execNextQuery);
+    m_runningQueryId = queryId;
 }
 
-bool MSqlQueryWorker::next() {
-    QMutexLocker locker(&mutex);
-    if(m_records.isEmpty()) return false;
-    if(m_currentItem+1 >= m_records.size()) return false;
-    m_currentItem++;
-    return true;
+void MSqlQueryWorker::closeCursor() {
+    if(m_cursorQueryId == -1) return;
+    m_cursorQueryId = -1;
+    q->finish();
+    m_connection->cursorClosed();
 }
 
-bool MSqlQueryWorker::seek(int index) {
-    QMutexLocker locker(&mutex);
-    if(index >= m_records.size()) {
-        return false;
-    } else {
-        m_currentItem = index;
-        return true;
-    }
+void MSqlQueryWorker::abandonFlight(const MSqlQueryExec &query) {
+    if(!query.flightKey.isEmpty())
+        MSqlSingleFlight::abandon(query.flightKey);
 }
 
-QSqlRecord MSqlQueryWorker::record() const {
-    QMutexLocker locker(&mutex);
-    QSqlRecord record = m_records.at(m_currentItem);
-    return record;
+bool MSqlQueryWorker::isSuperseded(int queryId) const {
+    return queryId < m_latestQueryId.loadAcquire();
 }
 
-QVariant MSqlQueryWorker::lastInsertId() const {
-    QMutexLocker locker(&mutex);
-    return m_lastInsertId;
+MSqlResult MSqlQueryWorker::lastResult() const {
+    return m_result;
 }
 
-QSqlError MSqlQueryWorker::lastError() const {
-    QMutexLocker locker(&mutex);
-    return m_lastError;
+MSqlQueryTimings MSqlQueryWorker::lastTimings() const {
+    return m_timings;
 }
 
 void MSqlQueryWorker::execNextQuery() {
-    QMutexLocker locker(&mutex);
-    if(!m_nextQuery.isReady) return; //if there is no query to execute
-    //take out next query
-    SqlQueryExec currentQuery = m_nextQuery;
-    m_nextQuery.isReady = false;
-    m_isBusy = true;
-    locker.unlock(); //unlock mutex
-    q->clear();
-    q->prepare(currentQuery.prepareStr);
+    runNextQuery();
+    if(!m_runningFlightKey.isEmpty()) { //the query has not published its result
+        MSqlSingleFlight::abandon(m_runningFlightKey);
+        m_runningFlightKey.clear();
+    }
+    setRunningQueryId(-1); //the query's statements are finished, it cannot be interrupted anymore
+}
+
+void MSqlQueryWorker::runNextQuery() {
+    //take out next query, skipping the ones that have been overwritten while queued
+    MSqlQueryExec currentQuery;
+    bool hasQuery = false;
+    while(!hasQuery && m_submissions.dequeue(currentQuery)) {
+        hasQuery = !isSuperseded(currentQuery.queryId);
+        if(!hasQuery)
+            abandonFlight(currentQuery);
+    }
+    if(!hasQuery) return; //if there is no query to execute
+    //timestamps are taken only if the query has been submitted with timing enabled, or if it is traced or may be logged
+    bool isTraced = MSqlTracer::isEnabled();
+    bool isLogged = m_slowQueryLog->isEnabled();
+    bool isTimed = currentQuery.submittedAt != 0 || isTraced || isLogged;
+    MSqlQueryTimings timings;
+    qint64 startedAt = MSqlQueryTimings::now(); //always taken, for the connection's statistics
+    timings.submitted = currentQuery.submittedAt;
+    timings.started = startedAt;
+    m_runningFlightKey = currentQuery.flightKey;
+    //closed before the query can be interrupted, as an open cursor prevents interrupting the connection
+    closeCursor();
+    setRunningQueryId(currentQuery.queryId);
+    if(isSuperseded(currentQuery.queryId)) return; //superseded before it could be interrupted
+    //clear any previous results (if any)
+    m_result = MSqlResult();
+    m_timings = MSqlQueryTimings();
+    //repeated statements are taken from the connection's cache, already prepared
+    //lazy queries keep their cursor open between jobs, so they always use their own query
+    QSqlQuery* query = currentQuery.isLazy ? nullptr : m_statementCache->prepared(currentQuery.prepareStr);
+    if(!query) { //the statement is not cached (or has failed to prepare, q reports the error in that case)
+        //created by the first query that needs it: a job posted before it could otherwise run it first
+        //(the thread runs its jobs by priority, not in the order they are posted)
+        if(!q)
+            q = new QSqlQuery(QSqlDatabase::database(m_connection->qtConnectionName()));
+        query = q;
+        q->clear();
+        q->setForwardOnly(true); //results are read only once, in order
+        q->prepare(currentQuery.prepareStr);
+    }
     for(const auto& bind : currentQuery.placeHolderBinds)
-        q->bindValue(std::get<0>(bind), std::get<1>(bind), std::get<2>(bind));
+        query->bindValue(std::get<0>(bind), std::get<1>(bind), std::get<2>(bind));
     for(const auto& bind : currentQuery.positionalBinds)
-        q->addBindValue(std::get<0>(bind), std::get<1>(bind));
+        query->addBindValue(std::get<0>(bind), std::get<1>(bind));
+    if(isTimed) timings.prepared = MSqlQueryTimings::now();
     bool result; //query execution result
     if(currentQuery.isBatch)
         //do exec batch if it is a batch query
-        result = q->execBatch(currentQuery.batchMode);
+        result = query->execBatch(currentQuery.batchMode);
     else
         //otherwise call normal exec
-        result = q->exec();
-    locker.relock(); //lock mutex to store new records
-    //clear any previous results (if any)
-    m_records.clear();
-    m_currentItem = -1; //before first item
-    m_lastInsertId = QVariant();
-    m_lastError = QSqlError();
-    if(m_nextQuery.isReady) //if another query has been scheduled
+        result = query->exec();
+    if(isTimed) timings.executed = MSqlQueryTimings::now();
+    if(isSuperseded(currentQuery.queryId)) { //if another query has been scheduled
+        query->finish();
         return; //cancel current query (no need to store its results)
+    }
+    MSqlResultBuilder builder(query->record());
+    builder.setStatistics(m_statistics);
+    m_fetchedRows = 0;
     if(result) { //execute statement
-        while(q->next()) m_records.append(q->record());
-        m_currentItem = -1; //before first item
-        m_lastInsertId = q->lastInsertId();
-        m_lastError = QSqlError();
-        m_isBusy = false;
+        builder.setLastInsertId(query->lastInsertId());
+        if(currentQuery.exportDevice) {
+            //export mode: rows are serialized as they are fetched, and are not stored
+            MSqlRowWriter writer(currentQuery.exportDevice, currentQuery.exportFormat);
+            int columnCount = query->record().count();
+            if(currentQuery.isExportingHeader)
+                writer.writeHeader(query->record());
+            while(!writer.hasError() && query->next() && !isSuperseded(currentQuery.queryId)) {
+                writer.writeRow(*query, columnCount);
+                m_fetchedRows++;
+            }
+            query->finish();
+            if(!writer.flush())
+                builder.setLastError(QSqlError(QString(), writer.errorString(), QSqlError::UnknownError));
+        } else if(currentQuery.chunkSize > 0 && currentQuery.isLazy) {
+            //lazy mode: only the first chunk is fetched, the cursor is kept open for fetchMore()
+            if(!fetchChunk(query, currentQuery.queryId, currentQuery.chunkSize)) {
+                m_connection->cursorOpened();
+                m_cursorQueryId = currentQuery.queryId;
+                m_cursorChunkSize = currentQuery.chunkSize;
+            }
+        } else if(currentQuery.chunkSize > 0) {
+            //streaming mode: rows are emitted in chunks while fetching, and are not stored
+            bool isFetched = fetchChunks(query, currentQuery.queryId, currentQuery.chunkSize);
+            query->finish();
+            if(!isFetched)
+                return; //cancel current query, another query has been scheduled
+        } else {
+            //stop fetching as soon as the query is superseded
+            while(query->next() && !isSuperseded(currentQuery.queryId)) builder.appendRow(*query);
+            query->finish(); //release the cursor, so that a cached statement can be executed again
+        }
     } else {
-        locker.relock(); //lock mutex to store new error
-        m_records.clear();
-        m_currentItem = -1; //before first item
-        m_lastInsertId = QVariant();
-        m_lastError= q->lastError();
-        m_isBusy = false;
+        builder.setLastError(query->lastError());
     }
-    locker.unlock();
-    emit resultsReady(currentQuery.queryId, result);
-}
-
-void MSqlQueryWorker::setNextQueryReady(bool isReady, bool isBatch, QSqlQuery::BatchExecutionMode batchMode) {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    m_nextQuery.isReady = isReady;
-    m_nextQuery.isBatch = isBatch;
-    m_nextQuery.batchMode = batchMode;
+    qint64 fetchedAt = MSqlQueryTimings::now();
+    if(isTimed) timings.fetched = fetchedAt;
+    int rows = builder.rowCount() + m_fetchedRows;
+    m_statistics->recordQuery(currentQuery.prepareStr, startedAt, fetchedAt, rows);
+    if(isTraced)
+        traceQuery(currentQuery, timings, rows);
+    bool isSlow = isLogged && m_slowQueryLog->isSlow(fetchedAt - startedAt);
+    if(isSuperseded(currentQuery.queryId)) //the query has been canceled (or interrupted) while fetching
+        return;
+    //publish the result as an immutable snapshot
+    m_result = builder.take();
+    m_timings = timings.isValid() ? timings : MSqlQueryTimings(); //timestamps taken for tracing only are not reported
+    if(!m_runningFlightKey.isEmpty()) { //share the result with identical queries waiting for it
+        MSqlSingleFlight::finish(m_runningFlightKey, m_result);
+        m_runningFlightKey.clear();
+    }
+    //the snapshot is shared with the client thread, rows are not copied
+    emit resultsReady(currentQuery.queryId, result, m_result, m_timings);
+    //logged after the result is delivered, so that capturing the plan does not delay it
+    if(isSlow)
+        logSlowQuery(currentQuery, timings, rows, m_result.lastError());
+}
+
+void MSqlQueryWorker::traceQuery(const MSqlQueryExec &query, const MSqlQueryTimings &timings, int rows) {
+    QVariantMap args;
+    args["queryId"] = query.queryId;
+    args["sql"] = query.prepareStr;
+    args["rows"] = rows;
+    MSqlTracer::recordSlice("query", "execute query", timings.started, timings.fetched, args);
+    MSqlTracer::recordSlice("query", "prepare", timings.started, timings.prepared);
+    MSqlTracer::recordSlice("query", "exec", timings.prepared, timings.executed);
+    MSqlTracer::recordSlice("query", "fetch", timings.executed, timings.fetched);
+    if(query.traceId)
+        MSqlTracer::recordFlow('t', "query", query.traceId, timings.started);
+}
+
+void MSqlQueryWorker::logSlowQuery(const MSqlQueryExec &query, const MSqlQueryTimings &timings, int rows, const QSqlError &error) {
+    MSqlSlowQuery entry;
+    entry.loggedAt = QDateTime::currentDateTime();
+    entry.connectionName = m_connection->qtConnectionName();
+    entry.sql = query.prepareStr;
+    for(const auto& bind : query.positionalBinds)
+        entry.positionalBinds.append(std::get<0>(bind));
+    for(const auto& bind : query.placeHolderBinds)
+        entry.placeHolderBinds.insert(std::get<0>(bind), std::get<1>(bind));
+    entry.isBatch = query.isBatch;
+    entry.rows = rows;
+    entry.error = error;
+    entry.timings = timings;
+    if(m_slowQueryLog->isPlanCaptured())
+        entry.plan = MSqlSlowQueryLog::capturePlan(QSqlDatabase::database(m_connection->qtConnectionName(), false), entry);
+    m_slowQueryLog->log(entry);
+}
+
+bool MSqlQueryWorker::fetchChunks(QSqlQuery *query, int queryId, int chunkSize) {
+    while(!fetchChunk(query, queryId, chunkSize)) {
+        if(isSuperseded(queryId)) //stop fetching if the rows are not interesting anymore
+            return false;
+    }
+    return true;
 }
 
-bool MSqlQueryWorker::hasNextQuery() const {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    return m_nextQuery.isReady;
+bool MSqlQueryWorker::fetchChunk(QSqlQuery *query, int queryId, int chunkSize) {
+    MSqlResultBuilder chunk(query->record());
+    chunk.setStatistics(m_statistics);
+    chunk.reserve(chunkSize);
+    while(chunk.rowCount() < chunkSize && query->next())
+        chunk.appendRow(*query);
+    m_fetchedRows += chunk.rowCount();
+    //a chunk that is not full means that there are no more rows
+    bool atEnd = chunk.rowCount() < chunkSize;
+    emit rowsAvailable(queryId, chunk.take(), atEnd);
+    return atEnd;
 }
 
-QList<QSqlRecord> MSqlQueryWorker::getAllRecords() const {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    return m_records;
+void MSqlQueryWorker::fetchMoreAsync(int queryId, MSqlPriority::Priority priority) {
+    m_thread->postJob(this, priority, [=]{
+        fetchMore(queryId);
+    });
 }
 
-bool MSqlQueryWorker::isBusy() const {
-    QMutexLocker locker(&mutex);
-    Q_UNUSED(locker)
-    return m_isBusy;
+void MSqlQueryWorker::fetchMore(int queryId) {
+    //if the cursor has been closed, or another query has been scheduled
+    if(queryId != m_cursorQueryId || isSuperseded(queryId)) return;
+    qint64 startedAt = MSqlQueryTimings::now();
+    m_fetchedRows = 0;
+    if(fetchChunk(q, queryId, m_cursorChunkSize))
+        closeCursor(); //release the cursor's resources, the result is not needed anymore
+    m_statistics->recordFetch(startedAt, MSqlQueryTimings::now(), m_fetchedRows);
 }
@@ -6,12 +6,59 @@
 #include <QSqlQuery>
 #include <QVariant>
 #include "msqldatabase.h"
+#include "msqlresult.h"
+#include "msqlquerytimings.h"
+#include "msqlrowformat.h"
+#include "msqlpriority.h"
+#include <QAtomicInt>
 #include <QMutex>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QHash>
+#include <QStringList>
+#include <QSharedPointer>
+#include <tuple>
+#include "msqlspscqueue.h"
 
 class MSqlQueryWorker;
+class MSqlThread;
+class MSqlStatementCache;
+class MSqlStatisticsCollector;
+class MSqlSlowQueryLog;
+class MSqlConnection;
+class MSqlResultCache;
+struct MSqlWorkerRef;
+
+//a query submitted to the worker: its SQL, its binds, and how it should be executed
+//this struct is internal to the library
+struct MSqlQueryExec {
+    using PlaceHolderBind = std::tuple<QString, QVariant, QSql::ParamType>;
+    using PositionalBind = std::tuple<QVariant, QSql::ParamType>;
+    //every query to be executed has an id, so that it can be overwritten later
+    //when a query is finished, its id is checked to make sure that it has not been overwritten
+    //(in order to emit resultsReady signal only for the last query set on this object)
+    int queryId = -1;
+    QString prepareStr;
+    QList<PlaceHolderBind> placeHolderBinds;
+    QList<PositionalBind> positionalBinds;
+    int positionalBindIndex = 0; //the index of the next positional bind to be set
+    bool isBatch = false;
+    QSqlQuery::BatchExecutionMode batchMode = QSqlQuery::ValuesAsRows;
+    int chunkSize = 0; //0 means no streaming
+    bool isLazy = false;
+    bool isPipelined = false; //pipelined queries do not overwrite previous queries
+    QByteArray flightKey; //set when the query leads a single-flight (see MSqlSingleFlight)
+    qint64 submittedAt = 0; //the time the query was submitted, 0 when timing is disabled
+    quint64 traceId = 0; //the id of the query's flow in MSqlTracer, 0 when the query is not traced
+    QIODevice* exportDevice = nullptr; //set when the rows are exported instead of being stored (see MSqlQuery::exportAsync)
+    MSqlRowFormat::Format exportFormat = MSqlRowFormat::Csv;
+    bool isExportingHeader = true;
+    MSqlPriority::Priority priority = MSqlPriority::Normal;
+};
 
 //all functions in this class do NOT block EXCEPT the exec() function
-//use execAsync() and connect to resultsReady() signal instead
+//use execAsync() and connect to resultsReady() signal instead,
+//or use the QFuture returned by execAsync() (see MSqlThen() in msqlfuture.h to chain continuations)
 class MSqlQuery : public QObject {
     Q_OBJECT
 public:
@@ -27,31 +74,195 @@ public:
     bool next();
     bool seek(int index);
     QSqlRecord record() const;
+    QVariant value(int index) const;
+    QVariant value(const QString& name) const;
     QSqlError lastError() const;
-    void execAsync(const QString& query);
-    void execAsync();
-    void execBatchAsync(QSqlQuery::BatchExecutionMode mode = QSqlQuery::ValuesAsRows);
+    //the returned future reports the query's result (and error) when it finishes,
+    //the future is canceled if the query gets overwritten by another one before it finishes
+    QFuture<MSqlResult> execAsync(const QString& query);
+    QFuture<MSqlResult> execAsync();
+    QFuture<MSqlResult> execBatchAsync(QSqlQuery::BatchExecutionMode mode = QSqlQuery::ValuesAsRows);
+    //executes the query, and writes its rows to device as they are fetched in the connection's thread,
+    //so that memory use does not depend on the result's size. the rows are NOT stored, the returned future
+    //reports a result holding the fields (without rows) and the error of the query or of the device (if any)
+    //for Csv and Tsv, the first row holds the names of the fields if withHeader is true
+    //the device is written in the connection's thread, so it must be a device that does not need an event loop
+    //(eg. QFile or QBuffer), it must not be used by other threads until the export finishes, and it must outlive it
+    QFuture<MSqlResult> exportAsync(const QString& query, QIODevice* device,
+                                    MSqlRowFormat::Format format = MSqlRowFormat::Csv, bool withHeader = true);
+    QFuture<MSqlResult> exportAsync(QIODevice* device, MSqlRowFormat::Format format = MSqlRowFormat::Csv,
+                                    bool withHeader = true);
     QString getDbConnectionName()const{return db.connectionName();}
+    //when rows > 0, execAsync() emits the rows in chunks of (at most) the given size through the rowsAvailable() signal
+    //while they are still being fetched, such rows are NOT stored (next(), record() and getAllRecords() will not return them)
+    //the default is 0, where all rows are stored and delivered together
+    void setChunkSize(int rows);
+    int chunkSize()const;
+    //when enabled (and a chunk size is set), execAsync() fetches only the first chunk, and keeps the cursor
+    //open in the connection thread, the following chunks are fetched only when fetchMoreAsync() is called
+    void setLazyFetch(bool lazy);
+    bool isLazyFetch()const;
+    //returns true if the last lazy query has more rows to fetch, and no fetch is in progress
+    bool canFetchMore()const;
+    //fetches the next chunk of the last lazy query, rows are delivered through the rowsAvailable() signal
+    void fetchMoreAsync();
+    //when enabled, every execAsync()/execBatchAsync() call is queued instead of overwriting the pending query,
+    //all queued queries are executed back-to-back in the connection's thread and every result is delivered
+    //(through the returned future, and the executionFinished() and resultsReady() signals)
+    //binds added after a query is submitted replace the previous ones (as in QSqlQuery), so the same
+    //prepared statement can be submitted many times with different values
+    //lazy fetching is not supported in pipelined mode
+    //in a routed group, reads and writes are queued on different connections, so they may finish out of order
+    void setPipelined(bool pipelined);
+    bool isPipelined()const;
+    //returns the id of the last submitted query, the same id is passed to executionFinished()
+    int lastExecutionId()const;
+    //when enabled, execAsync() looks the query (its SQL text and bind values) up in the connection's result cache
+    //(see MSqlDatabase::enableResultCache) and delivers a cached result without using the connection,
+    //otherwise the result is cached when the query succeeds, tagged with the given tags
+    //(usually the names of the tables the query reads, see MSqlDatabase::invalidateResultCache)
+    //streaming, lazy, batch and blocking queries are never cached
+    void setResultCaching(bool enabled, const QStringList& tags = QStringList());
+    bool isResultCaching()const;
+    //when enabled, an execAsync() call with the same SQL text and bind values (on the same connection name)
+    //as a query that is still running (in any MSqlQuery object with single-flight enabled) does not get executed,
+    //it gets the running query's result instead. enable it only for read-only queries
+    //streaming, lazy, batch and blocking queries are never deduplicated
+    void setSingleFlight(bool enabled);
+    bool isSingleFlight()const;
+    //when enabled, the phases of every execution (queueing in the connection's thread, prepare, exec, fetch
+    //and delivery to this thread) are timed, and the timings of the last finished query are returned by timings()
+    //timing is disabled by default, and costs nothing in that case
+    void setTimingEnabled(bool enabled);
+    bool isTimingEnabled()const;
+    MSqlQueryTimings timings()const;
+    //the priority of the following queries (and of fetching more rows in lazy mode) in the connection's thread,
+    //the connection always executes the waiting query with the highest priority first, (see MSqlPriority)
+    //queries submitted by the same MSqlQuery object are still executed in the order they have been submitted
+    //blocking queries (exec()) are executed as soon as the running query finishes, regardless of their priority
+    void setPriority(MSqlPriority::Priority priority);
+    MSqlPriority::Priority priority()const;
+    //in a routed group (see MSqlDatabase::addRoutedDatabase), SELECT statements and queries marked as read-only
+    //are executed by the least-loaded reader connection, all other queries by the writer connection
+    //mark queries that read without starting with SELECT (eg. WITH ... SELECT, or calls to read-only procedures) as read-only
+    //note that a statement marked as read-only must not write, as readers may be connected to replicas
+    void setReadOnly(bool readOnly);
+    bool isReadOnly()const;
+    //cancels all pending queries, their futures are canceled and their results are never delivered
+    //a query that is running is interrupted (when the driver supports it, see MSqlConnection::interrupt),
+    //otherwise it stops fetching rows as soon as possible, so that the connection is free for the next query
+    //note: the interruption acts on the whole connection. it is issued only while the canceled query's job runs on
+    //the connection (the jobs of a connection never run concurrently, and the query's statements are finished before
+    //its job ends), so it never aborts a statement of another query. it is skipped while another MSqlQuery keeps a
+    //lazy cursor open on the same connection, and it has no effect when issued before the query's statement starts.
+    //in these cases the running query only stops fetching, and its result is dropped
+    //note: queries that get overwritten by a new execAsync() call are canceled the same way
+    void cancel();
     QVariant lastInsertId()const;
 
     //additional functions
     bool isBusy()const;
+    //builds a QSqlRecord for every row, use result() instead where possible
     QList<QSqlRecord> getAllRecords() const;
+    //returns the result of the last finished query as an immutable snapshot,
+    //the snapshot is shared (not copied) and can be passed to any number of models (see MSqlQueryModel::setResult)
+    MSqlResult result() const;
 signals:
     void resultsReady(bool success);
+    //emitted (before resultsReady) for every finished query that has not been overwritten
+    void executionFinished(int executionId, const MSqlResult& result);
+    void rowsAvailable(const MSqlResult& rows);
     void busyToggled(bool isBusy);
 private:
-    Q_INVOKABLE void workerFinished(int queryId, bool success);
+    Q_INVOKABLE void workerFinished(int queryId, bool success, const MSqlResult& result, const MSqlQueryTimings& timings);
+    Q_INVOKABLE void workerRowsAvailable(int queryId, const MSqlResult& rows, bool atEnd);
     
-    bool execNextBlocking();
-    //pointer accessed only from the client thread
-    //passed to worker threads through lambdas capturing it by value, lives in database connection thread
-    MSqlQueryWorker* w;
+    bool execNextBlocking(bool isBatch, QSqlQuery::BatchExecutionMode batchMode = QSqlQuery::ValuesAsRows);
+    //prepares the client side state for a new async query, and returns its future
+    QFuture<MSqlResult> beginAsyncExec();
+    //returns the next query (with the given execution options) ready to be submitted to the worker
+    MSqlQueryExec takeNextQuery(bool isBatch, QSqlQuery::BatchExecutionMode batchMode, int chunkSize, bool isLazy);
+    //cancels the futures of all pending async queries
+    void cancelFutures();
+    //returns the result cache key of the next query
+    QByteArray nextQueryCacheKey()const;
+    //cancels the previous query in the worker (unless the query is pipelined), used by queries
+    //that are not submitted to the worker
+    void supersedeWorkerQuery(int queryId);
+    //delivers the given result to the query later (like the results of the queries executed by the worker)
+    void deliverLater(int queryId, const MSqlResult& result, qint64 submittedAt);
+    //delivers the flight's result to the query when the flight finishes,
+    //the query is submitted to the worker if the flight is abandoned
+    void followFlight(const MSqlQueryExec& query, const QFuture<MSqlResult>& flight);
+    //creates a worker attached to the given connection, and returns the reference the query uses it through
+    QSharedPointer<MSqlWorkerRef> createWorker(MSqlConnection* connection);
+    //returns all the workers of the query (w first)
+    QList<QSharedPointer<MSqlWorkerRef>> workers()const;
+    bool isReadQuery(const MSqlQueryExec& query)const;
+    //returns the worker the query is to be submitted to (see setReadOnly), and supersedes the previous query
+    //in the other workers (unless the query is pipelined), returns a null reference if there is no connection
+    QSharedPointer<MSqlWorkerRef> routeQuery(const MSqlQueryExec& query);
+    //routes the query, and queues it in its worker
+    //the query fails (with noConnectionResult()) if its connection name has not been added
+    void submitQuery(const MSqlQueryExec& query);
+    MSqlResult noConnectionResult()const;
+    //the workers are used through references that are accessed only from the client thread, a worker lives
+    //in its connection's thread, and must be used only while its reference is locked (see MSqlWorkerLocker)
+    //as it is destroyed with its connection (when the connection is replaced), the reference is cleared then
+    //in a routed group, w is attached to the writer
+    QSharedPointer<MSqlWorkerRef> w;
+    //the workers attached to the reader connections of a routed group (created when needed)
+    //readers are looked up for every query, as the group can be replaced (see MSqlDatabase::addRoutedDatabase),
+    //workers of readers that are not in the group anymore are dropped
+    QHash<MSqlConnection*, QSharedPointer<MSqlWorkerRef>> m_readerWorkers;
+    QSharedPointer<MSqlWorkerRef> m_lastWorker; //the worker the last query has been submitted to
+    bool m_isReadOnly = false;
     MSqlDatabase db;
     bool m_isBusy = false; //accessed only from client thread
     //when a query is finished, its id is checked to make sure that it matches currentQueryId
     //(in order to emit resultsReady signal only for the last query set on this object)
     int currentQueryId = -1;
+    //the query being built by prepare() and the bind functions, accessed only from the client thread
+    MSqlQueryExec m_nextQuery;
+    MSqlResult m_result; //snapshot of the last finished query, accessed only from client thread
+    //the cursor used by next(), seek() and value(), it is local to the client thread
+    int m_currentItem = -1; //before first item
+    //the futures of the pending async queries, by query id
+    //only the last query is pending, unless the query is pipelined
+    QHash<int, QFutureInterface<MSqlResult>> m_futures;
+    bool m_isPipelined = false;
+    bool m_isResultCaching = false;
+    bool m_isSingleFlight = false;
+    bool m_isTimingEnabled = false;
+    MSqlPriority::Priority m_priority = MSqlPriority::Normal;
+    MSqlQueryTimings m_timings; //timings of the last finished query
+    QStringList m_resultCacheTags;
+    //the pending queries whose results are to be cached when they finish
+    struct PendingCacheInsert {
+        QSharedPointer<MSqlResultCache> cache;
+        QByteArray key;
+        quint64 generation;
+    };
+    QHash<int, PendingCacheInsert> m_pendingCacheInserts;
+    int m_chunkSize = 0;
+    bool m_isLazyFetch = false;
+    //lazy fetch state of the current query, accessed only from the client thread
+    bool m_isCursorLazy = false;
+    bool m_canFetchMore = false;
+    bool m_isFetching = false;
+};
+
+//locks a query's reference to one of its workers, worker() is null if the worker has been destroyed
+//with its connection (or if the reference is null), the worker can be used only while the locker exists
+//this class is internal to the library
+class MSqlWorkerLocker {
+public:
+    explicit MSqlWorkerLocker(const QSharedPointer<MSqlWorkerRef>& ref);
+    MSqlQueryWorker* worker()const;
+private:
+    Q_DISABLE_COPY(MSqlWorkerLocker)
+    QSharedPointer<MSqlWorkerRef> m_ref; //keeps the mutex alive until it is unlocked
+    QMutexLocker m_locker;
 };
 
 //the worker object lives in the database connection's thread and owns the QSqlQuery instance
@@ -61,48 +272,73 @@ private:
 class MSqlQueryWorker : public QObject {
     Q_OBJECT
 public:
-    using PlaceHolderBind = std::tuple<QString, QVariant, QSql::ParamType>;
-    using PositionalBind = std::tuple<QVariant, QSql::ParamType>;
-
-    explicit MSqlQueryWorker(); //worker does not have a parent
+    //worker does not have a parent
+    explicit MSqlQueryWorker(MSqlConnection* connection);
     ~MSqlQueryWorker();
-    QSqlQuery* q; //accessed only from worker threads
-    //the following functions are thread-safe
-    void prepare(const QString &query);
-    void bindValue(const QString &placeholder, const QVariant &val, QSql::ParamType paramType);
-    void addBindValue(const QVariant& val, QSql::ParamType paramType = QSql::In);
-    void execAsync(int queryId, bool isBatch = false, QSqlQuery::BatchExecutionMode batchMode = QSqlQuery::ValuesAsRows);
-    bool next();
-    bool seek(int index);
-    QSqlRecord record() const;
-    QVariant lastInsertId() const;
-    QSqlError lastError() const;
-    void setNextQueryReady(bool isReady, bool isBatch = false, QSqlQuery::BatchExecutionMode batchMode = QSqlQuery::ValuesAsRows);
-    bool isBusy() const;
-    bool hasNextQuery() const;
-    QList<QSqlRecord> getAllRecords() const;
+    QSqlQuery* q = nullptr; //accessed only from worker threads, created by the first query that is not cached
+    //the following functions are called from the client thread only (the single producer of the submission queue)
+    //queues the query, it gets executed by the next call to execNextQuery()
+    void enqueue(const MSqlQueryExec& query);
+    //queues the query, and schedules its execution in the worker thread
+    void execAsync(const MSqlQueryExec& query);
+    //all queries with an id smaller than queryId are not interesting anymore (they are skipped or stopped)
+    void supersede(int queryId);
+    //interrupts the running query if it has been superseded
+    void interruptSuperseded();
+    void fetchMoreAsync(int queryId, MSqlPriority::Priority priority);
+    MSqlThread* connectionThread() const { return m_thread; }
+    //the reference the worker's query uses it through, cleared when the worker is destroyed with its connection
+    QSharedPointer<MSqlWorkerRef> ref() const { return m_ref; }
 
-    Q_SIGNAL void resultsReady(int queryId, bool success);
+    //returns the result (and timings) of the last executed query
+    MSqlResult lastResult() const;
+    MSqlQueryTimings lastTimings() const;
+    Q_SIGNAL void resultsReady(int queryId, bool success, MSqlResult result, MSqlQueryTimings timings);
+    //emitted in streaming and lazy modes only, atEnd is true when there are no more rows to fetch
+    Q_SIGNAL void rowsAvailable(int queryId, MSqlResult rows, bool atEnd);
     Q_INVOKABLE void execNextQuery(); //always invoked in worker thread
 private:
-    mutable QMutex mutex;
-    struct SqlQueryExec {
-        //every query to be executed has an id, so that it can be overwritten later
-        //when a query is finished, its id is checked to make sure that it has not been overwritten
-        //(in order to emit resultsReady signal only for the last query set on this object)
-        int queryId = -1; 
-        QString prepareStr;
-        QList<PlaceHolderBind> placeHolderBinds;
-        QList<PositionalBind> positionalBinds;
-        bool isBatch = false;
-        QSqlQuery::BatchExecutionMode batchMode;
-        bool isReady = false;
-    } m_nextQuery;
-    QList<QSqlRecord> m_records; //to store query result
-    int m_currentItem = -1; //before first item
-    bool m_isBusy = false;
-    QSqlError m_lastError;
-    QVariant m_lastInsertId; //to store query last insert id
+    void runNextQuery();
+    //records the phases of the query in MSqlTracer
+    void traceQuery(const MSqlQueryExec& query, const MSqlQueryTimings& timings, int rows);
+    //logs the query in the connection's slow query log, capturing its plan if enabled
+    void logSlowQuery(const MSqlQueryExec& query, const MSqlQueryTimings& timings, int rows, const QSqlError& error);
+    void setRunningQueryId(int queryId);
+    //closes the cursor left open by the last lazy query, if any
+    void closeCursor();
+    //abandons the single-flight the query leads (if any)
+    void abandonFlight(const MSqlQueryExec& query);
+    bool isSuperseded(int queryId) const;
+    //fetches the rows of the current result and emits them in chunks of chunkSize rows
+    //returns false if fetching was stopped because another query has been scheduled
+    bool fetchChunks(QSqlQuery* query, int queryId, int chunkSize);
+    //fetches and emits a single chunk, returns true if there are no more rows to fetch
+    bool fetchChunk(QSqlQuery* query, int queryId, int chunkSize);
+    void fetchMore(int queryId);
+    //the connection the worker is attached to, and its thread (the worker lives in), set on construction
+    MSqlConnection* m_connection;
+    MSqlThread* m_thread;
+    QSharedPointer<MSqlWorkerRef> m_ref;
+    MSqlStatementCache* m_statementCache;
+    QSharedPointer<MSqlStatisticsCollector> m_statistics;
+    QSharedPointer<MSqlSlowQueryLog> m_slowQueryLog;
+    int m_fetchedRows = 0; //rows emitted in chunks by the current job, for the connection's statistics
+    //queries submitted by the client thread, consumed by the worker thread
+    MSqlSpscQueue<MSqlQueryExec> m_submissions;
+    //the id of the last query that overwrites previous ones, written by the client thread
+    //a query is superseded when its id is smaller than this id
+    QAtomicInt m_latestQueryId;
+    //the id of the query being executed (-1 when idle), guarded by m_runningMutex so that the client thread
+    //never interrupts the connection after the query has finished (and another one may have started)
+    int m_runningQueryId = -1;
+    QMutex m_runningMutex;
+    MSqlResult m_result; //the result of the last executed query
+    MSqlQueryTimings m_timings;
+    //the single-flight led by the query being executed, it is abandoned if the query does not publish its result
+    QByteArray m_runningFlightKey;
+    //the id of the lazy query whose cursor is kept open in q
+    int m_cursorQueryId = -1;
+    int m_cursorChunkSize = 0;
 };
 
 #endif // MSQLQUERY_H
@@ -5,15 +5,49 @@ INCLUDEPATH += $$PWD
 
 CONFIG += c++11
 
+#add MSQLQUERY_SQLITE_INTERRUPT to DEFINES to interrupt SQLite statements when their queries are canceled
+#(Qt must be built with -system-sqlite, so that the library and the QSQLITE driver use the same SQLite library)
+contains(DEFINES, MSQLQUERY_SQLITE_INTERRUPT): LIBS += -lsqlite3
+
 SOURCES += \
+    $$PWD/msqlbulkloader.cpp \
+    $$PWD/msqlconnection.cpp \
     $$PWD/msqldatabase.cpp \
     $$PWD/msqlquery.cpp \
     $$PWD/msqlquerymodel.cpp \
-    $$PWD/msqlthread.cpp
+    $$PWD/msqlquerytimings.cpp \
+    $$PWD/msqlresult.cpp \
+    $$PWD/msqlresultcache.cpp \
+    $$PWD/msqlrowformat.cpp \
+    $$PWD/msqlsingleflight.cpp \
+    $$PWD/msqlslowquerylog.cpp \
+    $$PWD/msqlstatementcache.cpp \
+    $$PWD/msqlstatistics.cpp \
+    $$PWD/msqlthread.cpp \
+    $$PWD/msqltracer.cpp \
+    $$PWD/msqltransaction.cpp \
+    $$PWD/msqlwritebuffer.cpp
 
 HEADERS  += \
+    $$PWD/msqlbulkloader.h \
+    $$PWD/msqlconnection.h \
+    $$PWD/msqlcontention.h \
     $$PWD/msqldatabase.h \
+    $$PWD/msqlfuture.h \
     $$PWD/msqlquery.h \
     $$PWD/msqlquerymodel.h \
+    $$PWD/msqlpriority.h \
+    $$PWD/msqlquerytimings.h \
+    $$PWD/msqlresult.h \
+    $$PWD/msqlresultcache.h \
+    $$PWD/msqlrowformat.h \
+    $$PWD/msqlsingleflight.h \
+    $$PWD/msqlslowquerylog.h \
+    $$PWD/msqlspscqueue.h \
+    $$PWD/msqlstatementcache.h \
+    $$PWD/msqlstatistics.h \
     $$PWD/qthreadutils.h \
-    $$PWD/msqlthread.h
+    $$PWD/msqlthread.h \
+    $$PWD/msqltracer.h \
+    $$PWD/msqltransaction.h \
+    $$PWD/msqlwritebuffer.h
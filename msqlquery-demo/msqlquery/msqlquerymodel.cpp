@@ -1,5 +1,6 @@
 #include "msqlquerymodel.h"
 #include "msqlquery.h"
+#include <algorithm>
 
 MSqlQueryModel::MSqlQueryModel(QObject *parent)
     : QAbstractTableModel(parent), m_query(nullptr) {
@@ -10,20 +11,23 @@ MSqlQueryModel::~MSqlQueryModel(){
 
 int MSqlQueryModel::rowCount(const QModelIndex &parent) const {
     if(parent.isValid()) return 0;
-    return m_records.size();
+    return m_rowCount;
 }
 
 int MSqlQueryModel::columnCount(const QModelIndex &parent) const {
     if(parent.isValid()) return 0;
-    if(!m_records.isEmpty())
-        return m_records.first().count();
-    else
-        return 0;
+    if(m_pages.isEmpty()) return 0;
+    return m_pages.first().columnCount();
 }
 
 QVariant MSqlQueryModel::data(const QModelIndex &index, int role) const {
-    if(role == Qt::DisplayRole || role == Qt::EditRole)
-        return m_records.at(index.row()).value(index.column());
+    if(!index.isValid() || index.row() >= m_rowCount) return QVariant();
+    if(role == Qt::DisplayRole || role == Qt::EditRole) {
+        //find the last page starting at or before the row
+        auto page = std::upper_bound(m_pageOffsets.constBegin(), m_pageOffsets.constEnd(), index.row()) - 1;
+        int pageIndex = page - m_pageOffsets.constBegin();
+        return m_pages.at(pageIndex).value(index.row() - *page, index.column());
+    }
 
     return QVariant();
 }
@@ -31,9 +35,8 @@ QVariant MSqlQueryModel::data(const QModelIndex &index, int role) const {
 QVariant MSqlQueryModel::headerData(int section, Qt::Orientation orientation, int role) const {
     if(role == Qt::DisplayRole) {
         if(orientation == Qt::Horizontal) {
-            if(!m_records.isEmpty()) {
-                return m_records.first().fieldName(section);
-            }
+            if(!m_pages.isEmpty())
+                return m_pages.first().fieldName(section);
         }
         if(orientation == Qt::Vertical) {
             return QString::number(section);
@@ -42,11 +45,39 @@ QVariant MSqlQueryModel::headerData(int section, Qt::Orientation orientation, in
     return QVariant();
 }
 
+bool MSqlQueryModel::canFetchMore(const QModelIndex &parent) const {
+    if(parent.isValid() || !m_query) return false;
+    return m_query->canFetchMore();
+}
+
+void MSqlQueryModel::fetchMore(const QModelIndex &parent) {
+    if(parent.isValid() || !m_query) return;
+    m_query->fetchMoreAsync();
+}
+
+void MSqlQueryModel::setFetchPageSize(int rows) {
+    m_fetchPageSize = qMax(rows, 0);
+}
+
+int MSqlQueryModel::fetchPageSize() const {
+    return m_fetchPageSize;
+}
+
+void MSqlQueryModel::setResult(const MSqlResult &result) {
+    delete m_query; //the model does not get its data from a query anymore
+    m_query = nullptr;
+    m_shownExecutionId = -1;
+    beginResetModel();
+    resetPages(result);
+    endResetModel();
+}
+
 void MSqlQueryModel::setQuery(MSqlQuery* query) {
     delete m_query; //delete old m_query
     //MSqlQuery::exec() should be called on the query object
     m_query= query;
     m_query->setParent(this); //take ownership
+    m_shownExecutionId = -1;
     queryGotResults(true);
 }
 
@@ -54,28 +85,68 @@ void MSqlQueryModel::setQueryAsync(MSqlQuery* query) {
     delete m_query; //delete old m_query
     m_query= query;
     m_query->setParent(this); //take ownership
-    connect(query, &MSqlQuery::resultsReady, this, &MSqlQueryModel::queryGotResults);
+    connectQuery(query);
 }
 
 void MSqlQueryModel::setQuery(const QString &query, const QString &dbConnectionName){
     delete m_query; //delete old m_query
     m_query = new MSqlQuery(this, MSqlDatabase::database(dbConnectionName));
+    m_shownExecutionId = -1;
     bool success = m_query->exec(query);
     queryGotResults(success);
 }
 
-void MSqlQueryModel::setQueryAsync(const QString &query, const QString &dbConnectionName){
+QFuture<MSqlResult> MSqlQueryModel::setQueryAsync(const QString &query, const QString &dbConnectionName){
     delete m_query; //delete old m_query
     m_query = new MSqlQuery(this, MSqlDatabase::database(dbConnectionName));
-    m_query->execAsync(query);
-    connect(m_query, &MSqlQuery::resultsReady, this, &MSqlQueryModel::queryGotResults);
+    if(m_fetchPageSize > 0) {
+        m_query->setChunkSize(m_fetchPageSize);
+        m_query->setLazyFetch(true);
+    }
+    QFuture<MSqlResult> future = m_query->execAsync(query);
+    connectQuery(m_query);
+    return future;
+}
+
+void MSqlQueryModel::connectQuery(MSqlQuery *query) {
+    m_shownExecutionId = -1;
+    connect(query, &MSqlQuery::resultsReady, this, &MSqlQueryModel::queryGotResults);
+    //in streaming/lazy mode, rows arrive before resultsReady()
+    connect(query, &MSqlQuery::rowsAvailable, this, &MSqlQueryModel::queryGotRows);
+}
+
+void MSqlQueryModel::queryGotRows(const MSqlResult &rows) {
+    if(m_shownExecutionId != m_query->lastExecutionId()) { //first rows of a new execution
+        beginResetModel();
+        resetPages(rows);
+        m_shownExecutionId = m_query->lastExecutionId();
+        endResetModel();
+    } else {
+        beginInsertRows(QModelIndex(), m_rowCount, m_rowCount + rows.rowCount() - 1);
+        //the chunk is kept as a separate page, so that its rows are not copied
+        m_pageOffsets.append(m_rowCount);
+        m_pages.append(rows);
+        m_rowCount += rows.rowCount();
+        endInsertRows();
+    }
+}
+
+void MSqlQueryModel::resetPages(const MSqlResult &result) {
+    m_pages.clear();
+    m_pageOffsets.clear();
+    m_pages.append(result);
+    m_pageOffsets.append(0);
+    m_rowCount = result.rowCount();
 }
 
 void MSqlQueryModel::queryGotResults(bool success){
     if(success) {
-        //copy results to the internal m_recList
+        //rows have already been delivered through queryGotRows()
+        if(m_shownExecutionId == m_query->lastExecutionId()) return;
+        //share the query's result snapshot (rows are not copied)
         beginResetModel();
-        m_records = m_query->getAllRecords();
+        resetPages(m_query->result());
+        m_shownExecutionId = m_query->lastExecutionId();
         endResetModel();
     } else {
         qCritical("MSqlQueryModel::queryGotResults success is false");
@@ -83,5 +154,5 @@ void MSqlQueryModel::queryGotResults(bool success){
 }
 
 bool MSqlQueryModel::isBusy()const{
-    return m_query->isBusy();
+    return m_query && m_query->isBusy();
 }
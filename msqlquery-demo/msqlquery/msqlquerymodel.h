@@ -5,6 +5,8 @@
 #include <QAbstractTableModel>
 #include <QSqlRecord>
 #include "msqldatabase.h"
+#include "msqlresult.h"
+#include <QFuture>
 
 class MSqlQuery;
 
@@ -23,8 +25,17 @@ public:
     virtual int columnCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
     virtual QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+    virtual bool canFetchMore(const QModelIndex &parent) const;
+    virtual void fetchMore(const QModelIndex &parent);
     bool isBusy()const;
     
+    //! Sets the number of rows fetched at a time by setQueryAsync(const QString&, const QString&).
+    //! When rows > 0, only the first page is fetched, and the cursor is kept open in the connection's thread.
+    //! The following pages are fetched asynchronously when the view asks for them through fetchMore().
+    //! The default is 0, where the whole result is fetched before the model is reset.
+    void setFetchPageSize(int rows);
+    int fetchPageSize()const;
+    
     
     //! Resets the model and sets the data provider to be the given query, returns immediately, does not block.
     //! If the function is called while model was busy executing another query,
@@ -47,18 +58,35 @@ public:
     //! Resets the model and sets the data provider to be the given query, returns immediately, does not block.
     //! If the function is called while model was busy executing another query,
     //! the model executes the query set by this function as soon as it is done with the current query
-    Q_INVOKABLE void setQueryAsync(const QString& query,  const QString& dbConnectionName = MSqlDatabase::defaultConnectionName);
+    //! The returned future reports the query's result when the model is reset (see MSqlQuery::execAsync).
+    Q_INVOKABLE QFuture<MSqlResult> setQueryAsync(const QString& query,  const QString& dbConnectionName = MSqlDatabase::defaultConnectionName);
     
     //! Resets the model and sets the data provider to be the given query. this function blocks, until the query is finished.
     //! This function does basically the same thing done by QSqlQueryModel::setQuery.
     //! It just calls QSqlQueryModel::setQuery from the other thread. and blocks until the query finishes.
     Q_INVOKABLE void setQuery(const QString& query,  const QString& dbConnectionName = MSqlDatabase::defaultConnectionName);
     
+    //! Resets the model to show the given result snapshot (for example, MSqlQuery::result() or the result of another model's query).
+    //! The snapshot is shared and not copied, so any number of models can show the same result.
+    //! Any query previously set on the model is deleted.
+    void setResult(const MSqlResult& result);
+    
 private slots:
     void queryGotResults(bool success);
+    void queryGotRows(const MSqlResult& rows);
 private:
+    void connectQuery(MSqlQuery* query);
+    void resetPages(const MSqlResult& result);
     MSqlQuery* m_query;
-    QList<QSqlRecord> m_records;
+    //the rows shown in the model, as a list of shared result snapshots (pages)
+    //a single page is used unless rows are streamed/fetched lazily in chunks
+    QVector<MSqlResult> m_pages;
+    QVector<int> m_pageOffsets; //the index of the first row of each page
+    int m_rowCount = 0;
+    int m_fetchPageSize = 0;
+    //the execution of m_query (see MSqlQuery::lastExecutionId) whose rows are shown, -1 if none
+    //the model is reset when an execution delivers its first rows, and following chunks are appended
+    int m_shownExecutionId = -1;
 };
 
 #endif // MSQLQUERYMODEL_H
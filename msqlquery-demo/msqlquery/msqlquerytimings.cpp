@@ -0,0 +1,12 @@
+#include "msqlquerytimings.h"
+#include <QElapsedTimer>
+
+qint64 MSqlQueryTimings::now() {
+    //a single reference for all threads, so that timestamps taken in different threads can be compared
+    static QElapsedTimer clock = []{
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+    return clock.nsecsElapsed() + 1; //never 0, as 0 means "not recorded"
+}
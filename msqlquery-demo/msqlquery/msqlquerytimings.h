@@ -0,0 +1,36 @@
+#ifndef MSQLQUERYTIMINGS_H
+#define MSQLQUERYTIMINGS_H
+
+#include <QtGlobal>
+#include <QMetaType>
+
+//the timestamps of the phases of a query's execution, in nanoseconds of a monotonic clock (see now())
+//timestamps are recorded only when timing is enabled on the query (see MSqlQuery::setTimingEnabled),
+//a timestamp is 0 if timing is disabled, or the phase has been skipped (eg. results delivered from the result cache
+//or from another query's single-flight only have the submitted and delivered timestamps)
+struct MSqlQueryTimings {
+    qint64 submitted = 0; //exec()/execAsync() has been called, in the client thread
+    qint64 started = 0; //the connection's thread has started executing the query (after the query waited in its queue)
+    qint64 prepared = 0; //the statement has been prepared (or taken from the statement cache) and bound
+    qint64 executed = 0; //the statement has been executed
+    qint64 fetched = 0; //all rows have been fetched
+    qint64 delivered = 0; //the result has been delivered to the client thread
+
+    bool isValid()const{return submitted != 0;}
+    //durations of the phases in nanoseconds
+    qint64 queueTime()const{return span(submitted, started);}
+    qint64 prepareTime()const{return span(started, prepared);}
+    qint64 execTime()const{return span(prepared, executed);}
+    qint64 fetchTime()const{return span(executed, fetched);}
+    qint64 deliveryTime()const{return span(fetched ? fetched : submitted, delivered);}
+    qint64 totalTime()const{return span(submitted, delivered);}
+
+    //the current time of the monotonic clock used for all timestamps, thread-safe
+    static qint64 now();
+private:
+    static qint64 span(qint64 from, qint64 to){return from && to ? to - from : 0;}
+};
+
+Q_DECLARE_METATYPE(MSqlQueryTimings)
+
+#endif // MSQLQUERYTIMINGS_H
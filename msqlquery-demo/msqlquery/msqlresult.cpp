@@ -0,0 +1,106 @@
+#include "msqlresult.h"
+#include "msqlstatistics.h"
+#include <QSqlQuery>
+
+MSqlResultData::~MSqlResultData() {
+    if(statistics)
+        statistics->resultReleased(byteSize);
+}
+
+MSqlResult::MSqlResult() {
+    //all empty results share the same data
+    static const QSharedPointer<const MSqlResultData> emptyData(new MSqlResultData);
+    d = emptyData;
+}
+
+MSqlResult::MSqlResult(const QSharedPointer<const MSqlResultData> &data):d(data) {
+}
+
+QString MSqlResult::fieldName(int column) const {
+    return d->schema.fieldName(column);
+}
+
+int MSqlResult::indexOf(const QString &name) const {
+    return d->schema.indexOf(name);
+}
+
+QVariant MSqlResult::value(int row, int column) const {
+    if(row < 0 || row >= rowCount() || column < 0 || column >= d->columnCount)
+        return QVariant();
+    return d->values.at(row*d->columnCount + column);
+}
+
+QVariant MSqlResult::value(int row, const QString &name) const {
+    return value(row, indexOf(name));
+}
+
+QSqlRecord MSqlResult::record(int row) const {
+    QSqlRecord record = d->schema;
+    for(int i=0; i<d->columnCount; i++)
+        record.setValue(i, value(row, i));
+    return record;
+}
+
+QList<QSqlRecord> MSqlResult::toRecordList() const {
+    QList<QSqlRecord> records;
+    records.reserve(rowCount());
+    for(int i=0; i<rowCount(); i++)
+        records.append(record(i));
+    return records;
+}
+
+MSqlResultBuilder::MSqlResultBuilder(const QSqlRecord &schema) {
+    m_data.schema = schema;
+    m_data.schema.clearValues();
+    m_data.columnCount = schema.count();
+}
+
+int MSqlResultBuilder::rowCount() const {
+    return m_data.columnCount>0 ? m_data.values.size()/m_data.columnCount : 0;
+}
+
+void MSqlResultBuilder::reserve(int rows) {
+    m_data.values.reserve(rows*m_data.columnCount);
+}
+
+void MSqlResultBuilder::appendRow(const QSqlQuery &query) {
+    for(int i=0; i<m_data.columnCount; i++)
+        m_data.values.append(query.value(i));
+}
+
+void MSqlResultBuilder::setLastError(const QSqlError &error) {
+    m_data.lastError = error;
+}
+
+void MSqlResultBuilder::setLastInsertId(const QVariant &id) {
+    m_data.lastInsertId = id;
+}
+
+void MSqlResultBuilder::setStatistics(const QSharedPointer<MSqlStatisticsCollector> &statistics) {
+    m_statistics = statistics;
+}
+
+MSqlResult MSqlResultBuilder::take() {
+    QSharedPointer<MSqlResultData> data(new MSqlResultData);
+    data->schema = m_data.schema;
+    data->columnCount = m_data.columnCount;
+    data->values.swap(m_data.values);
+    data->lastError = m_data.lastError;
+    data->lastInsertId = m_data.lastInsertId;
+    m_data.lastError = QSqlError();
+    m_data.lastInsertId = QVariant();
+    if(m_statistics) {
+        //an estimate: the variants themselves, plus the heap data of strings and byte arrays
+        qint64 byteSize = sizeof(MSqlResultData) + data->values.capacity()*qint64(sizeof(QVariant));
+        for(const QVariant& value : data->values) {
+            if(value.type() == QVariant::String)
+                byteSize += value.toString().size()*qint64(sizeof(QChar));
+            else if(value.type() == QVariant::ByteArray)
+                byteSize += value.toByteArray().size();
+        }
+        data->statistics = m_statistics;
+        data->byteSize = byteSize;
+        m_statistics->resultAllocated(byteSize);
+    }
+    return MSqlResult(data);
+}
@@ -0,0 +1,88 @@
+#ifndef MSQLRESULT_H
+#define MSQLRESULT_H
+
+#include <QSqlRecord>
+#include <QSqlError>
+#include <QVector>
+#include <QList>
+#include <QVariant>
+#include <QSharedPointer>
+#include <QMetaType>
+
+class QSqlQuery;
+class MSqlStatisticsCollector;
+
+//the data of a query result
+//the fields' names and types (schema) are stored only once for the whole result,
+//and the values of all rows are stored contiguously (row after row)
+struct MSqlResultData {
+    MSqlResultData():columnCount(0), byteSize(0){}
+    ~MSqlResultData();
+    QSqlRecord schema;
+    int columnCount;
+    QVector<QVariant> values;
+    QSqlError lastError;
+    QVariant lastInsertId;
+    //the statistics of the connection that produced the result, the result's estimated size
+    //is subtracted from the connection's held bytes when the result is destroyed
+    QSharedPointer<MSqlStatisticsCollector> statistics;
+    qint64 byteSize;
+};
+
+//an immutable snapshot of the rows of a query result
+//copying an MSqlResult only increments a reference count, the rows are never copied,
+//so a single result can be shared by the worker, MSqlQuery, any number of models and user code
+//all functions are const and thread-safe (as the data is never modified after the result is built)
+class MSqlResult {
+public:
+    MSqlResult();
+    
+    int rowCount()const{return d->columnCount>0 ? d->values.size()/d->columnCount : 0;}
+    int columnCount()const{return d->columnCount;}
+    bool isEmpty()const{return d->values.isEmpty();}
+    //returns a record containing field information only (without values)
+    QSqlRecord schema()const{return d->schema;}
+    QString fieldName(int column)const;
+    int indexOf(const QString& name)const;
+    QVariant value(int row, int column)const;
+    QVariant value(int row, const QString& name)const;
+    //builds a QSqlRecord for the given row, use value() where possible as it does not copy field information
+    QSqlRecord record(int row)const;
+    QList<QSqlRecord> toRecordList()const;
+    
+    //the error of the query that produced the result (if any)
+    QSqlError lastError()const{return d->lastError;}
+    bool isSuccess()const{return d->lastError.type() == QSqlError::NoError;}
+    QVariant lastInsertId()const{return d->lastInsertId;}
+private:
+    friend class MSqlResultBuilder;
+    explicit MSqlResult(const QSharedPointer<const MSqlResultData>& data);
+    QSharedPointer<const MSqlResultData> d;
+};
+
+Q_DECLARE_METATYPE(MSqlResult)
+
+//builds an MSqlResult while fetching rows from a QSqlQuery
+//this class is internal to the library, it is used from the connection's thread only
+class MSqlResultBuilder {
+public:
+    //the builder takes the fields in the given record as the result's schema (values are ignored)
+    explicit MSqlResultBuilder(const QSqlRecord& schema);
+    
+    int rowCount()const;
+    void reserve(int rows);
+    //appends the row the query is positioned on, the query must have the same fields as the schema
+    void appendRow(const QSqlQuery& query);
+    void setLastError(const QSqlError& error);
+    void setLastInsertId(const QVariant& id);
+    //results taken from the builder are accounted in the given connection statistics while they are referenced
+    void setStatistics(const QSharedPointer<MSqlStatisticsCollector>& statistics);
+    //moves the rows appended so far into an immutable MSqlResult (without copying them)
+    //the builder is left empty, with the same schema (and without error/last insert id)
+    MSqlResult take();
+private:
+    MSqlResultData m_data;
+    QSharedPointer<MSqlStatisticsCollector> m_statistics;
+};
+
+#endif // MSQLRESULT_H
@@ -0,0 +1,72 @@
+#include "msqlresultcache.h"
+#include <QMutexLocker>
+
+MSqlResultCache::MSqlResultCache(int maxEntries, int ttlMsecs)
+    : m_entries(qMax(maxEntries, 1)), m_ttlMsecs(ttlMsecs) {
+}
+
+bool MSqlResultCache::lookup(const QByteArray &key, MSqlResult *result) {
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker)
+    Entry* entry = m_entries.object(key);
+    if(!entry) return false;
+    if(m_ttlMsecs > 0 && entry->age.hasExpired(m_ttlMsecs)) {
+        m_entries.remove(key);
+        m_tags.remove(key);
+        return false;
+    }
+    *result = entry->result; //the result is shared, not copied
+    return true;
+}
+
+quint64 MSqlResultCache::generation() const {
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker)
+    return m_generation;
+}
+
+void MSqlResultCache::insert(const QByteArray &key, const MSqlResult &result, const QStringList &tags, quint64 generation) {
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker)
+    if(generation != m_generation) //the result may have been invalidated while it was being fetched
+        return;
+    Entry* entry = new Entry;
+    entry->result = result;
+    entry->age.start();
+    m_entries.insert(key, entry);
+    m_tags.insert(key, tags);
+    if(m_tags.size() > 2*m_entries.maxCost())
+        pruneTags();
+}
+
+void MSqlResultCache::invalidate(const QString &tag) {
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker)
+    m_generation++;
+    for(auto i = m_tags.begin(); i != m_tags.end();) {
+        if(i.value().contains(tag)) {
+            m_entries.remove(i.key());
+            i = m_tags.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    pruneTags();
+}
+
+void MSqlResultCache::clear() {
+    QMutexLocker locker(&m_mutex);
+    Q_UNUSED(locker)
+    m_generation++;
+    m_entries.clear();
+    m_tags.clear();
+}
+
+void MSqlResultCache::pruneTags() {
+    for(auto i = m_tags.begin(); i != m_tags.end();) {
+        if(!m_entries.contains(i.key()))
+            i = m_tags.erase(i);
+        else
+            ++i;
+    }
+}
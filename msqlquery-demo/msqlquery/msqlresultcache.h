@@ -0,0 +1,49 @@
+#ifndef MSQLRESULTCACHE_H
+#define MSQLRESULTCACHE_H
+
+#include <QByteArray>
+#include <QStringList>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include "msqlresult.h"
+
+//a cache of query results shared by all MSqlQuery objects using the same connection name (see MSqlDatabase::enableResultCache)
+//results are keyed by their query's SQL text and bind values, and are tagged (usually with the names of
+//the tables they read) so that they can be invalidated when the tables change
+//all functions are thread-safe
+//this class is internal to the library
+class MSqlResultCache {
+public:
+    //ttlMsecs <= 0 means that results do not expire
+    MSqlResultCache(int maxEntries, int ttlMsecs);
+
+    //returns true and sets result if the key has a result that has not expired
+    bool lookup(const QByteArray& key, MSqlResult* result);
+    //the generation is incremented every time results are invalidated
+    //get it before submitting a query, and pass it to insert() when the query finishes, so that
+    //results read before an invalidation are not cached after it
+    quint64 generation()const;
+    void insert(const QByteArray& key, const MSqlResult& result, const QStringList& tags, quint64 generation);
+    //removes all results tagged with the given tag
+    void invalidate(const QString& tag);
+    void clear();
+private:
+    Q_DISABLE_COPY(MSqlResultCache)
+    //removes the tags of the entries that have been evicted from m_entries
+    void pruneTags();
+    struct Entry {
+        MSqlResult result;
+        QElapsedTimer age;
+    };
+    mutable QMutex m_mutex;
+    QCache<QByteArray, Entry> m_entries;
+    //the tags of every entry, kept apart from the entries, as looking up entries in
+    //a QCache marks them as recently used
+    QHash<QByteArray, QStringList> m_tags;
+    int m_ttlMsecs;
+    quint64 m_generation = 0;
+};
+
+#endif // MSQLRESULTCACHE_H
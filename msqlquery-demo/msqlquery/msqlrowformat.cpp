@@ -0,0 +1,188 @@
+#include "msqlrowformat.h"
+#include <QIODevice>
+#include <QSqlQuery>
+#include <QSqlRecord>
+
+MSqlRowReader::MSqlRowReader(QIODevice *device, MSqlRowFormat::Format format)
+    : m_device(device), m_format(format) {
+    if(m_format == MSqlRowFormat::Binary) {
+        m_stream.setDevice(m_device);
+        m_stream.setVersion(QDataStream::Qt_5_0);
+    }
+}
+
+bool MSqlRowReader::readRow(QVariantList *row) {
+    if(hasError()) return false;
+    row->clear();
+    bool isRead;
+    switch(m_format) {
+    case MSqlRowFormat::Csv:
+        isRead = readCsvRow(row);
+        break;
+    case MSqlRowFormat::Tsv:
+        isRead = readTsvRow(row);
+        break;
+    default:
+        isRead = readBinaryRow(row);
+    }
+    if(isRead)
+        m_rowNumber++;
+    return isRead;
+}
+
+bool MSqlRowReader::readLine(QString *line) {
+    if(m_device->atEnd()) return false;
+    *line = QString::fromUtf8(m_device->readLine());
+    return true;
+}
+
+bool MSqlRowReader::readCsvRow(QVariantList *row) {
+    QString line;
+    do { //blank lines are skipped
+        if(!readLine(&line)) return false;
+    } while(line.trimmed().isEmpty());
+    QString field;
+    bool isQuoted = false; //the field started with a quote
+    bool isInQuotes = false;
+    auto appendField = [&]{
+        //an empty unquoted field is NULL
+        row->append(isQuoted || !field.isEmpty() ? QVariant(field) : QVariant(QVariant::String));
+        field.clear();
+        isQuoted = false;
+    };
+    forever {
+        for(int i=0; i<line.size(); i++) {
+            QChar c = line.at(i);
+            if(isInQuotes) {
+                if(c != '"') {
+                    field += c; //line breaks in quoted fields are kept
+                } else if(i+1 < line.size() && line.at(i+1) == '"') { //an escaped quote
+                    field += c;
+                    i++;
+                } else {
+                    isInQuotes = false;
+                }
+            } else if(c == '"' && field.isEmpty() && !isQuoted) {
+                isQuoted = isInQuotes = true;
+            } else if(c == ',') {
+                appendField();
+            } else if(c != '\r' && c != '\n') {
+                field += c;
+            }
+        }
+        if(!isInQuotes) break;
+        //the quoted field continues on the next line
+        if(!readLine(&line)) {
+            m_errorString = QStringLiteral("row %0: unterminated quoted field").arg(m_rowNumber+1);
+            return false;
+        }
+    }
+    appendField();
+    return true;
+}
+
+bool MSqlRowReader::readTsvRow(QVariantList *row) {
+    QString line;
+    do {
+        if(!readLine(&line)) return false;
+    } while(line.trimmed().isEmpty());
+    while(line.endsWith('\n') || line.endsWith('\r'))
+        line.chop(1);
+    for(const QString& escapedField : line.split('\t')) {
+        if(escapedField == QLatin1String("\\N")) {
+            row->append(QVariant(QVariant::String));
+            continue;
+        }
+        QString field;
+        field.reserve(escapedField.size());
+        for(int i=0; i<escapedField.size(); i++) {
+            QChar c = escapedField.at(i);
+            if(c == '\\' && i+1 < escapedField.size()) {
+                QChar escaped = escapedField.at(++i);
+                if(escaped == 't') field += '\t';
+                else if(escaped == 'n') field += '\n';
+                else if(escaped == 'r') field += '\r';
+                else field += escaped;
+            } else {
+                field += c;
+            }
+        }
+        row->append(field);
+    }
+    return true;
+}
+
+bool MSqlRowReader::readBinaryRow(QVariantList *row) {
+    if(m_stream.atEnd()) return false;
+    m_stream >> *row;
+    if(m_stream.status() != QDataStream::Ok) {
+        m_errorString = QStringLiteral("row %0: truncated or corrupt row").arg(m_rowNumber+1);
+        return false;
+    }
+    return true;
+}
+
+MSqlRowWriter::MSqlRowWriter(QIODevice *device, MSqlRowFormat::Format format)
+    : m_device(device), m_format(format), m_stream(&m_buffer, QIODevice::WriteOnly) {
+    m_stream.setVersion(QDataStream::Qt_5_0);
+    m_buffer.reserve(bufferSize);
+}
+
+void MSqlRowWriter::writeHeader(const QSqlRecord &record) {
+    if(m_format == MSqlRowFormat::Binary) return;
+    for(int i=0; i<record.count(); i++) {
+        if(i > 0) m_buffer += m_format == MSqlRowFormat::Csv ? ',' : '\t';
+        writeText(record.fieldName(i));
+    }
+    m_buffer += '\n';
+}
+
+void MSqlRowWriter::writeRow(const QSqlQuery &query, int columnCount) {
+    if(m_format == MSqlRowFormat::Binary) {
+        //the same layout as a QVariantList written using QDataStream (the number of values, followed by the values)
+        m_stream << quint32(columnCount);
+        for(int i=0; i<columnCount; i++)
+            m_stream << query.value(i);
+    } else {
+        for(int i=0; i<columnCount; i++) {
+            if(i > 0) m_buffer += m_format == MSqlRowFormat::Csv ? ',' : '\t';
+            writeText(query.value(i));
+        }
+        m_buffer += '\n';
+    }
+    if(m_buffer.size() >= bufferSize)
+        flush();
+}
+
+bool MSqlRowWriter::flush() {
+    if(hasError()) return false;
+    if(!m_buffer.isEmpty() && m_device->write(m_buffer) != m_buffer.size())
+        m_errorString = m_device->errorString().isEmpty() ? QStringLiteral("failed to write to the device") : m_device->errorString();
+    //the stream keeps writing at its position in the buffer, so it must be rewound with it
+    m_buffer.resize(0); //keeps the reserved capacity
+    m_stream.device()->seek(0);
+    return !hasError();
+}
+
+void MSqlRowWriter::writeText(const QVariant &value) {
+    if(m_format == MSqlRowFormat::Tsv) {
+        if(value.isNull()) {
+            m_buffer += "\\N";
+            return;
+        }
+        QString text = value.toString();
+        text.replace('\\', QLatin1String("\\\\")).replace('\t', QLatin1String("\\t"))
+                .replace('\n', QLatin1String("\\n")).replace('\r', QLatin1String("\\r"));
+        m_buffer += text.toUtf8();
+        return;
+    }
+    //Csv: NULL is written as an empty field, an empty string as a quoted empty field
+    if(value.isNull()) return;
+    QString text = value.toString();
+    if(text.isEmpty() || text.contains(',') || text.contains('"') || text.contains('\n') || text.contains('\r')) {
+        text.replace('"', QLatin1String("\"\""));
+        m_buffer += '"' + text.toUtf8() + '"';
+    } else {
+        m_buffer += text.toUtf8();
+    }
+}
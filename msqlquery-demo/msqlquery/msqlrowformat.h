@@ -0,0 +1,79 @@
+#ifndef MSQLROWFORMAT_H
+#define MSQLROWFORMAT_H
+
+#include <QVariant>
+#include <QDataStream>
+
+class QIODevice;
+class QSqlQuery;
+class QSqlRecord;
+
+//row formats used to import (see MSqlBulkLoader) and export (see MSqlQuery::exportAsync) rows
+namespace MSqlRowFormat {
+enum Format {
+    //comma separated values (RFC 4180), UTF-8 encoded
+    //fields containing commas, quotes or line breaks are quoted, an empty unquoted field is NULL
+    Csv,
+    //tab separated values, UTF-8 encoded, as produced by PostgreSQL's COPY in text format
+    //tabs, line breaks and backslashes in fields are escaped with a backslash, and \N is NULL
+    Tsv,
+    //every row is a QVariantList written using QDataStream (version Qt_5_0), values keep their types
+    Binary
+};
+}
+
+//reads rows from a device in one of the formats above
+//this class is internal to the library
+class MSqlRowReader {
+public:
+    MSqlRowReader(QIODevice* device, MSqlRowFormat::Format format);
+
+    //reads the next row into row, returns false at the end of the device or on error (see hasError())
+    bool readRow(QVariantList* row);
+    bool hasError()const{ return !m_errorString.isEmpty(); }
+    QString errorString()const{ return m_errorString; }
+    //the number of rows read so far
+    qint64 rowNumber()const{ return m_rowNumber; }
+private:
+    Q_DISABLE_COPY(MSqlRowReader)
+    bool readCsvRow(QVariantList* row);
+    bool readTsvRow(QVariantList* row);
+    bool readBinaryRow(QVariantList* row);
+    //reads the next line (including its line break), returns false at the end of the device
+    bool readLine(QString* line);
+
+    QIODevice* m_device;
+    MSqlRowFormat::Format m_format;
+    QDataStream m_stream;
+    qint64 m_rowNumber = 0;
+    QString m_errorString;
+};
+
+//writes rows to a device in one of the formats above, rows written by the writer can be read by MSqlRowReader
+//the output is buffered, call flush() after writing the last row
+//this class is internal to the library
+class MSqlRowWriter {
+public:
+    MSqlRowWriter(QIODevice* device, MSqlRowFormat::Format format);
+
+    //writes the names of the fields as the first row (only for Csv and Tsv)
+    void writeHeader(const QSqlRecord& record);
+    //writes the row the query is positioned on, without copying its values into a row first
+    void writeRow(const QSqlQuery& query, int columnCount);
+    //writes the buffered output to the device, returns false if the device failed
+    bool flush();
+    bool hasError()const{ return !m_errorString.isEmpty(); }
+    QString errorString()const{ return m_errorString; }
+private:
+    Q_DISABLE_COPY(MSqlRowWriter)
+    static const int bufferSize = 64*1024;
+    void writeText(const QVariant& value);
+
+    QIODevice* m_device;
+    MSqlRowFormat::Format m_format;
+    QByteArray m_buffer;
+    QDataStream m_stream; //writes to m_buffer in the Binary format
+    QString m_errorString;
+};
+
+#endif // MSQLROWFORMAT_H
@@ -0,0 +1,48 @@
+#include "msqlsingleflight.h"
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFutureInterface>
+#include <QGlobalStatic>
+
+struct MSqlFlights {
+    QHash<QByteArray, QFutureInterface<MSqlResult>> dict;
+    QMutex mutex;
+};
+Q_GLOBAL_STATIC(MSqlFlights, getMSqlFlights)
+
+QFuture<MSqlResult> MSqlSingleFlight::join(const QByteArray &key, bool *isLeader) {
+    MSqlFlights* flights = getMSqlFlights();
+    QMutexLocker locker(&flights->mutex);
+    Q_UNUSED(locker)
+    auto i = flights->dict.find(key);
+    if(i != flights->dict.end()) {
+        *isLeader = false;
+        return i.value().future();
+    }
+    QFutureInterface<MSqlResult> flight;
+    flight.reportStarted();
+    flights->dict.insert(key, flight);
+    *isLeader = true;
+    return flight.future();
+}
+
+void MSqlSingleFlight::finish(const QByteArray &key, const MSqlResult &result) {
+    MSqlFlights* flights = getMSqlFlights();
+    QMutexLocker locker(&flights->mutex);
+    QFutureInterface<MSqlResult> flight = flights->dict.take(key);
+    locker.unlock(); //followers are notified without holding the mutex
+    if(!flight.isStarted()) return; //no flight in progress
+    flight.reportResult(result);
+    flight.reportFinished();
+}
+
+void MSqlSingleFlight::abandon(const QByteArray &key) {
+    MSqlFlights* flights = getMSqlFlights();
+    QMutexLocker locker(&flights->mutex);
+    QFutureInterface<MSqlResult> flight = flights->dict.take(key);
+    locker.unlock();
+    if(!flight.isStarted()) return; //no flight in progress
+    flight.reportCanceled();
+    flight.reportFinished();
+}
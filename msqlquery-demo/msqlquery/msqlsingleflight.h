@@ -0,0 +1,26 @@
+#ifndef MSQLSINGLEFLIGHT_H
+#define MSQLSINGLEFLIGHT_H
+
+#include <QByteArray>
+#include <QFuture>
+#include "msqlresult.h"
+
+//deduplicates identical queries running at the same time (see MSqlQuery::setSingleFlight)
+//the first query with a given key (the leader) starts a flight and gets executed, the following
+//ones (the followers) join the flight and get the leader's result when it finishes
+//all functions are thread-safe
+//this class is internal to the library
+class MSqlSingleFlight {
+public:
+    //returns the future of the flight in progress for the key, or starts a new flight and sets isLeader to true
+    static QFuture<MSqlResult> join(const QByteArray& key, bool* isLeader);
+    //finishes the flight, its future reports the result to the followers
+    static void finish(const QByteArray& key, const MSqlResult& result);
+    //abandons the flight (the leader has been canceled), its future is canceled,
+    //followers should execute their queries themselves in that case
+    static void abandon(const QByteArray& key);
+private:
+    MSqlSingleFlight();
+};
+
+#endif // MSQLSINGLEFLIGHT_H
@@ -0,0 +1,139 @@
+#include "msqlslowquerylog.h"
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
+#include <QFile>
+
+//formats a duration in nanoseconds as milliseconds
+static QString formatMsecs(qint64 nsecs) {
+    return QString::number(nsecs/1000000.0, 'f', 3);
+}
+
+static QString formatValue(const QVariant& value) {
+    if(value.isNull())
+        return QStringLiteral("NULL");
+    if(value.type() == QVariant::String)
+        return QStringLiteral("'%0'").arg(value.toString());
+    if(value.type() == QVariant::ByteArray)
+        return QStringLiteral("<%0 bytes>").arg(value.toByteArray().size());
+    if(value.type() == QVariant::List) { //batch binds
+        QStringList values;
+        for(const QVariant& item : value.toList())
+            values.append(formatValue(item));
+        return QStringLiteral("[%0]").arg(values.join(QStringLiteral(", ")));
+    }
+    return value.toString();
+}
+
+QString MSqlSlowQuery::toString() const {
+    QString text = QStringLiteral("%0 [%1] slow query: %2 ms (prepare %3, exec %4, fetch %5")
+            .arg(loggedAt.toString(Qt::ISODateWithMs), connectionName, formatMsecs(timings.fetched - timings.started),
+                 formatMsecs(timings.prepareTime()), formatMsecs(timings.execTime()), formatMsecs(timings.fetchTime()));
+    if(timings.isValid())
+        text += QStringLiteral(", queued %0").arg(formatMsecs(timings.queueTime()));
+    text += QStringLiteral("), %0 rows").arg(rows);
+    if(error.type() != QSqlError::NoError)
+        text += QStringLiteral(", error: %0").arg(error.text());
+    text += QStringLiteral("\n  sql: %0\n").arg(sql);
+    if(!positionalBinds.isEmpty() || !placeHolderBinds.isEmpty()) {
+        QStringList binds;
+        for(const QVariant& value : positionalBinds)
+            binds.append(formatValue(value));
+        for(auto i = placeHolderBinds.constBegin(); i != placeHolderBinds.constEnd(); ++i)
+            binds.append(QStringLiteral("%0=%1").arg(i.key(), formatValue(i.value())));
+        text += QStringLiteral("  binds%0: %1\n").arg(isBatch ? QStringLiteral(" (batch)") : QString(), binds.join(QStringLiteral(", ")));
+    }
+    if(!plan.isEmpty()) {
+        text += QStringLiteral("  plan:\n");
+        for(const QString& line : plan.split('\n'))
+            text += QStringLiteral("    %0\n").arg(line);
+    }
+    return text;
+}
+
+MSqlSlowQueryLog::MSqlSlowQueryLog()
+    : m_thresholdMsecs(-1), m_isPlanCaptured(1) {
+}
+
+bool MSqlSlowQueryLog::isSlow(qint64 nsecs) const {
+    int thresholdMsecs = m_thresholdMsecs.load();
+    return thresholdMsecs >= 0 && nsecs >= thresholdMsecs*Q_INT64_C(1000000);
+}
+
+void MSqlSlowQueryLog::setLogFile(const QString &fileName, qint64 maxBytes, int maxFiles) {
+    QMutexLocker locker(&m_mutex);
+    m_fileName = fileName;
+    m_maxBytes = maxBytes;
+    m_maxFiles = maxFiles;
+}
+
+void MSqlSlowQueryLog::setCallback(const Callback &callback) {
+    QMutexLocker locker(&m_mutex);
+    m_callback = callback;
+}
+
+void MSqlSlowQueryLog::log(const MSqlSlowQuery &entry) {
+    Callback callback;
+    {
+        QMutexLocker locker(&m_mutex);
+        if(!m_fileName.isEmpty())
+            writeToFile(entry.toString());
+        callback = m_callback;
+    }
+    //the callback is called without holding the lock, so that it can reconfigure the log
+    if(callback)
+        callback(entry);
+}
+
+void MSqlSlowQueryLog::writeToFile(const QString &text) {
+    QFile file(m_fileName);
+    if(m_maxBytes > 0 && file.size() >= m_maxBytes)
+        rotate();
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return;
+    file.write(text.toUtf8());
+    file.write("\n");
+}
+
+void MSqlSlowQueryLog::rotate() {
+    //fileName.(maxFiles-1) -> fileName.maxFiles, ..., fileName -> fileName.1
+    QFile::remove(QStringLiteral("%0.%1").arg(m_fileName).arg(m_maxFiles));
+    for(int i=m_maxFiles-1; i>=1; i--)
+        QFile::rename(QStringLiteral("%0.%1").arg(m_fileName).arg(i), QStringLiteral("%0.%1").arg(m_fileName).arg(i+1));
+    if(m_maxFiles > 0)
+        QFile::rename(m_fileName, m_fileName + QStringLiteral(".1"));
+    else
+        QFile::remove(m_fileName);
+}
+
+QString MSqlSlowQueryLog::capturePlan(QSqlDatabase db, const MSqlSlowQuery &entry) {
+    if(entry.isBatch) return QString();
+    QString explain;
+    QString driverName = db.driverName();
+    if(driverName == QLatin1String("QSQLITE"))
+        explain = QStringLiteral("EXPLAIN QUERY PLAN ");
+    else if(driverName == QLatin1String("QPSQL") || driverName == QLatin1String("QMYSQL"))
+        explain = QStringLiteral("EXPLAIN "); //the statement is planned, but not executed (as it would be with ANALYZE)
+    else
+        return QString();
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if(!query.prepare(explain + entry.sql))
+        return QString();
+    for(const QVariant& value : entry.positionalBinds)
+        query.addBindValue(value);
+    for(auto i = entry.placeHolderBinds.constBegin(); i != entry.placeHolderBinds.constEnd(); ++i)
+        query.bindValue(i.key(), i.value());
+    if(!query.exec())
+        return QString();
+    QStringList lines;
+    while(query.next()) {
+        QStringList columns;
+        for(int i=0; i<query.record().count(); i++)
+            columns.append(query.value(i).toString());
+        lines.append(columns.join(QStringLiteral(" | ")));
+    }
+    return lines.join('\n');
+}
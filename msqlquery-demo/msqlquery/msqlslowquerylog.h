@@ -0,0 +1,77 @@
+#ifndef MSQLSLOWQUERYLOG_H
+#define MSQLSLOWQUERYLOG_H
+
+#include <QString>
+#include <QVariant>
+#include <QSqlError>
+#include <QDateTime>
+#include <QMutex>
+#include <QAtomicInt>
+#include <functional>
+#include "msqlquerytimings.h"
+
+class QSqlDatabase;
+
+//an entry of the slow query log (see MSqlDatabase::setSlowQueryThreshold)
+struct MSqlSlowQuery {
+    QDateTime loggedAt;
+    QString connectionName; //the name of the connection in the pool that executed the query
+    QString sql;
+    QVariantList positionalBinds;
+    QVariantMap placeHolderBinds;
+    bool isBatch = false;
+    int rows = 0;
+    QSqlError error; //the query's error, if it failed
+    //the submitted timestamp (and queueTime()) is set only if timing is enabled on the query (see MSqlQuery::setTimingEnabled),
+    //delivered is never set, as the query is logged in the connection's thread
+    MSqlQueryTimings timings;
+    //the plan of the statement, captured right after it has been executed on the same connection
+    //(eg. EXPLAIN QUERY PLAN on SQLite), one row per line with columns separated by " | "
+    //empty if plan capture is disabled, if the driver is not supported or for batch queries
+    QString plan;
+
+    //a human readable multi-line description of the entry, as written to the log file
+    QString toString()const;
+};
+
+//the slow query log shared by all connections in a pool
+//the threshold is checked with a single atomic load, the sinks are used (under a lock) only when a query is slow
+//this class is internal to the library
+class MSqlSlowQueryLog {
+public:
+    typedef std::function<void(const MSqlSlowQuery&)> Callback;
+    MSqlSlowQueryLog();
+
+    //the following functions are thread-safe
+    //a negative threshold disables the log
+    void setThreshold(int msecs){ m_thresholdMsecs.store(msecs); }
+    int threshold()const{ return m_thresholdMsecs.load(); }
+    bool isEnabled()const{ return m_thresholdMsecs.load() >= 0; }
+    bool isSlow(qint64 nsecs)const;
+    void setPlanCapture(bool enabled){ m_isPlanCaptured.store(enabled ? 1 : 0); }
+    bool isPlanCaptured()const{ return m_isPlanCaptured.load() != 0; }
+    //entries are appended to fileName, when the file grows beyond maxBytes it is renamed to fileName.1
+    //(fileName.1 to fileName.2 and so on), and at most maxFiles old files are kept
+    //an empty fileName disables the file
+    void setLogFile(const QString& fileName, qint64 maxBytes, int maxFiles);
+    void setCallback(const Callback& callback);
+    void log(const MSqlSlowQuery& entry);
+
+    //captures the plan of the statement on the given database, must be called from the database's thread
+    static QString capturePlan(QSqlDatabase db, const MSqlSlowQuery& entry);
+private:
+    Q_DISABLE_COPY(MSqlSlowQueryLog)
+    void writeToFile(const QString& text);
+    void rotate();
+
+    QAtomicInt m_thresholdMsecs;
+    QAtomicInt m_isPlanCaptured;
+    //guarded by m_mutex
+    QMutex m_mutex;
+    QString m_fileName;
+    qint64 m_maxBytes = 0;
+    int m_maxFiles = 0;
+    Callback m_callback;
+};
+
+#endif // MSQLSLOWQUERYLOG_H
@@ -0,0 +1,53 @@
+#ifndef MSQLSPSCQUEUE_H
+#define MSQLSPSCQUEUE_H
+
+#include <QAtomicPointer>
+
+//an unbounded lock-free queue for exactly one producer thread and one consumer thread
+//enqueue() must be called from the producer thread only, dequeue() and isEmpty() from the consumer thread only
+//the queue always holds a dummy node at its head, so that the producer and the consumer never touch the same node's link
+//this class is internal to the library
+template <typename T>
+class MSqlSpscQueue {
+public:
+    MSqlSpscQueue():m_head(new Node), m_tail(m_head) {}
+    ~MSqlSpscQueue() {
+        while(m_head) {
+            Node* next = m_head->next.load();
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    void enqueue(const T& value) {
+        Node* node = new Node;
+        node->value = value;
+        //the release store publishes the value to the consumer together with the node
+        m_tail->next.storeRelease(node);
+        m_tail = node;
+    }
+    //returns false if the queue is empty
+    bool dequeue(T& value) {
+        Node* next = m_head->next.loadAcquire();
+        if(!next) return false;
+        value = next->value;
+        next->value = T(); //the node becomes the new dummy node, it should not keep the value alive
+        delete m_head;
+        m_head = next;
+        return true;
+    }
+    bool isEmpty()const {
+        return !m_head->next.loadAcquire();
+    }
+private:
+    Q_DISABLE_COPY(MSqlSpscQueue)
+    struct Node {
+        Node():next(nullptr){}
+        T value;
+        QAtomicPointer<Node> next;
+    };
+    Node* m_head; //accessed only from the consumer thread
+    Node* m_tail; //accessed only from the producer thread
+};
+
+#endif // MSQLSPSCQUEUE_H
@@ -0,0 +1,43 @@
+#include "msqlstatementcache.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+MSqlStatementCache::MSqlStatementCache(const QString &qtConnectionName, int capacity)
+    : m_qtConnectionName(qtConnectionName), m_cache(capacity), m_capacity(capacity) {
+}
+
+MSqlStatementCache::~MSqlStatementCache() {
+}
+
+QSqlQuery *MSqlStatementCache::prepared(const QString &sql) {
+    int capacity = m_capacity.load();
+    if(m_cache.maxCost() != capacity) //evicts least recently used statements if the capacity has been decreased
+        m_cache.setMaxCost(capacity);
+    if(capacity <= 0) return nullptr;
+    QSqlQuery* query = m_cache.object(sql); //marks the statement as the most recently used one
+    if(query) {
+        m_hitCount.ref();
+        //the values bound by the previous user of the statement are reset, so that placeholders that
+        //are not bound again are null (as in a newly prepared statement), instead of keeping stale values
+        for(int i=0; i<query->boundValues().size(); i++)
+            query->bindValue(i, QVariant());
+        return query;
+    }
+    m_missCount.ref();
+    query = new QSqlQuery(QSqlDatabase::database(m_qtConnectionName, false));
+    query->setForwardOnly(true); //results are read only once, in order
+    if(!query->prepare(sql)) {
+        delete query;
+        return nullptr;
+    }
+    m_cache.insert(sql, query);
+    return query;
+}
+
+void MSqlStatementCache::clear() {
+    m_cache.clear();
+}
+
+void MSqlStatementCache::setCapacity(int capacity) {
+    m_capacity.store(qMax(capacity, 0));
+}
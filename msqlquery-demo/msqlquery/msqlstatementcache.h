@@ -0,0 +1,45 @@
+#ifndef MSQLSTATEMENTCACHE_H
+#define MSQLSTATEMENTCACHE_H
+
+#include <QString>
+#include <QCache>
+#include <QAtomicInt>
+
+class QSqlQuery;
+
+//an LRU cache of prepared statements (keyed by their SQL text) that belongs to a single connection
+//repeated statements reuse the cached QSqlQuery, so that the driver does not parse/plan them again
+//the cache (and the queries in it) are accessed only from the connection's thread, except
+//functions marked as thread-safe
+//this class is internal to the library
+class MSqlStatementCache {
+public:
+    static const int defaultCapacity = 32;
+    explicit MSqlStatementCache(const QString& qtConnectionName, int capacity = defaultCapacity);
+    ~MSqlStatementCache();
+
+    //returns a forward-only query prepared with the given SQL, either from the cache or newly prepared (and cached)
+    //returns nullptr if the cache is disabled (capacity is 0), or if the statement fails to prepare
+    //the returned query is owned by the cache, and is valid until the next call to prepared() or clear()
+    //call QSqlQuery::finish() on it when its rows are not needed anymore
+    //the values bound to a cached query are reset to null before it is returned
+    QSqlQuery* prepared(const QString& sql);
+    //destroys all cached statements, must be called before the connection is closed or removed
+    void clear();
+
+    //the following functions are thread-safe
+    //the new capacity is applied the next time the cache is used from the connection's thread
+    void setCapacity(int capacity);
+    int capacity()const{ return m_capacity.load(); }
+    int hitCount()const{ return m_hitCount.load(); }
+    int missCount()const{ return m_missCount.load(); }
+private:
+    Q_DISABLE_COPY(MSqlStatementCache)
+    QString m_qtConnectionName;
+    QCache<QString, QSqlQuery> m_cache;
+    QAtomicInt m_capacity;
+    QAtomicInt m_hitCount;
+    QAtomicInt m_missCount;
+};
+
+#endif // MSQLSTATEMENTCACHE_H
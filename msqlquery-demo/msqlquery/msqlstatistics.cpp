@@ -0,0 +1,163 @@
+#include "msqlstatistics.h"
+#include "msqlquerytimings.h"
+#include <QStringList>
+
+MSqlLatencyHistogram::MSqlLatencyHistogram()
+    : m_count(0), m_totalNsecs(0), m_maxNsecs(0) {
+    for(int i=0; i<bucketCount; i++)
+        m_buckets[i] = 0;
+}
+
+void MSqlLatencyHistogram::record(qint64 nsecs) {
+    if(nsecs < 0) nsecs = 0;
+    int bucket = 0;
+    for(qint64 usecs = nsecs/1000; usecs > 0 && bucket < bucketCount-1; usecs >>= 1)
+        bucket++;
+    m_buckets[bucket]++;
+    m_count++;
+    m_totalNsecs += nsecs;
+    m_maxNsecs = qMax(m_maxNsecs, nsecs);
+}
+
+void MSqlLatencyHistogram::merge(const MSqlLatencyHistogram &other) {
+    for(int i=0; i<bucketCount; i++)
+        m_buckets[i] += other.m_buckets[i];
+    m_count += other.m_count;
+    m_totalNsecs += other.m_totalNsecs;
+    m_maxNsecs = qMax(m_maxNsecs, other.m_maxNsecs);
+}
+
+qint64 MSqlLatencyHistogram::bucketUpperBound(int bucket) {
+    return (Q_INT64_C(1) << bucket) * 1000;
+}
+
+qint64 MSqlLatencyHistogram::percentile(double p) const {
+    if(m_count == 0) return 0;
+    qint64 rank = qMax(Q_INT64_C(1), qint64(p/100.0*m_count + 0.5));
+    qint64 seen = 0;
+    for(int i=0; i<bucketCount; i++) {
+        seen += m_buckets[i];
+        if(seen >= rank)
+            return qMin(bucketUpperBound(i), m_maxNsecs);
+    }
+    return m_maxNsecs;
+}
+
+const QString MSqlStatisticsCollector::otherFingerprint = QStringLiteral("<other>");
+
+MSqlStatisticsCollector::MSqlStatisticsCollector()
+    : m_createdAt(MSqlQueryTimings::now()) {
+}
+
+void MSqlStatisticsCollector::recordQuery(const QString &sql, qint64 startedAt, qint64 finishedAt, int rows) {
+    qint64 latency = finishedAt - startedAt;
+    m_busyNsecs.fetchAndAddRelaxed(latency);
+    m_queriesExecuted.fetchAndAddRelaxed(1);
+    m_rowsFetched.fetchAndAddRelaxed(rows);
+    m_pendingLatencies[cachedFingerprint(sql)].record(latency);
+    publishLatencies();
+}
+
+void MSqlStatisticsCollector::recordFetch(qint64 startedAt, qint64 finishedAt, int rows) {
+    m_busyNsecs.fetchAndAddRelaxed(finishedAt - startedAt);
+    m_rowsFetched.fetchAndAddRelaxed(rows);
+}
+
+MSqlConnectionStatistics MSqlStatisticsCollector::snapshot() const {
+    MSqlConnectionStatistics statistics;
+    statistics.busyNsecs = m_busyNsecs.load();
+    statistics.idleNsecs = qMax(Q_INT64_C(0), MSqlQueryTimings::now() - m_createdAt - statistics.busyNsecs);
+    statistics.queriesExecuted = m_queriesExecuted.load();
+    statistics.rowsFetched = m_rowsFetched.load();
+    statistics.resultBytes = m_resultBytes.load();
+    QMutexLocker locker(&m_latenciesMutex);
+    statistics.latencies = m_latencies;
+    return statistics;
+}
+
+QString MSqlStatisticsCollector::cachedFingerprint(const QString &sql) {
+    auto it = m_fingerprints.constFind(sql);
+    if(it != m_fingerprints.constEnd())
+        return it.value();
+    if(m_fingerprints.size() >= 4*maxFingerprints) //statements built without binds would grow the cache forever
+        m_fingerprints.clear();
+    QString normalized = fingerprint(sql);
+    //the number of histograms is bounded, even if the application generates many distinct statements
+    if(!m_latencies.contains(normalized) && !m_pendingLatencies.contains(normalized)
+            && m_latencies.size() + m_pendingLatencies.size() >= maxFingerprints)
+        normalized = otherFingerprint;
+    m_fingerprints.insert(sql, normalized);
+    return normalized;
+}
+
+void MSqlStatisticsCollector::publishLatencies() {
+    //if a reader holds the lock, the histograms are published after a later query instead of waiting for it
+    if(!m_latenciesMutex.tryLock()) return;
+    for(auto it = m_pendingLatencies.constBegin(); it != m_pendingLatencies.constEnd(); ++it)
+        m_latencies[it.key()].merge(it.value());
+    m_latenciesMutex.unlock();
+    m_pendingLatencies.clear();
+}
+
+QString MSqlStatisticsCollector::fingerprint(const QString &sql) {
+    QStringList tokens;
+    auto isWordChar = [](QChar c){ return c.isLetterOrNumber() || c == '_' || c == '$'; };
+    int i = 0;
+    const int n = sql.size();
+    while(i < n) {
+        QChar c = sql.at(i);
+        if(c.isSpace()) {
+            i++;
+        } else if(c == '-' && i+1 < n && sql.at(i+1) == '-') { //line comment
+            while(i < n && sql.at(i) != '\n') i++;
+        } else if(c == '/' && i+1 < n && sql.at(i+1) == '*') { //block comment
+            int end = sql.indexOf(QLatin1String("*/"), i+2);
+            i = end == -1 ? n : end+2;
+        } else if(c == '\'') { //string literal, quotes are escaped by doubling them
+            i++;
+            while(i < n) {
+                if(sql.at(i) == '\'') {
+                    if(i+1 < n && sql.at(i+1) == '\'') { i += 2; continue; }
+                    break;
+                }
+                i++;
+            }
+            i++;
+            tokens.append(QStringLiteral("?"));
+        } else if(c == '"' || c == '`' || c == '[') { //quoted identifier, kept as is
+            QChar close = c == '[' ? QChar(']') : c;
+            int end = sql.indexOf(close, i+1);
+            end = end == -1 ? n : end+1;
+            tokens.append(sql.mid(i, end-i));
+            i = end;
+        } else if(c.isDigit() || (c == '.' && i+1 < n && sql.at(i+1).isDigit())) { //numeric literal
+            i++;
+            while(i < n && (isWordChar(sql.at(i)) || sql.at(i) == '.'
+                            || ((sql.at(i) == '+' || sql.at(i) == '-') && sql.at(i-1).toLower() == 'e')))
+                i++;
+            tokens.append(QStringLiteral("?"));
+        } else if(isWordChar(c) || ((c == ':' || c == '@') && i+1 < n && isWordChar(sql.at(i+1))
+                                    && (i == 0 || sql.at(i-1) != ':'))) { //identifier, keyword or named placeholder
+            int start = i++;
+            while(i < n && isWordChar(sql.at(i))) i++;
+            tokens.append(sql.mid(start, i-start));
+        } else if(c == '?') {
+            i++;
+            tokens.append(QStringLiteral("?"));
+        } else { //operators, consecutive operator characters (eg. "<=", "::") make up a single token
+            int start = i++;
+            if(c != '(' && c != ')' && c != ',' && c != ';')
+                while(i < n && QStringLiteral("<>=!|&:+-*/%").contains(sql.at(i))) i++;
+            tokens.append(sql.mid(start, i-start));
+        }
+        //"?, ?, ?" (eg. IN lists with a varying number of values) is collapsed to a single "?"
+        if(tokens.size() >= 3 && tokens.last() == QLatin1String("?") && tokens.at(tokens.size()-2) == QLatin1String(",")
+                && tokens.at(tokens.size()-3) == QLatin1String("?")) {
+            tokens.removeLast();
+            tokens.removeLast();
+        }
+    }
+    while(!tokens.isEmpty() && tokens.last() == QLatin1String(";"))
+        tokens.removeLast();
+    return tokens.join(' ');
+}
@@ -0,0 +1,96 @@
+#ifndef MSQLSTATISTICS_H
+#define MSQLSTATISTICS_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInteger>
+
+//a latency histogram with power-of-two buckets
+//bucket 0 counts latencies below 1 microsecond, bucket i (i > 0) counts latencies in [2^(i-1), 2^i) microseconds,
+//the last bucket also counts anything longer
+class MSqlLatencyHistogram {
+public:
+    static const int bucketCount = 32;
+    MSqlLatencyHistogram();
+
+    void record(qint64 nsecs);
+    void merge(const MSqlLatencyHistogram& other);
+
+    qint64 count()const{return m_count;}
+    qint64 totalNsecs()const{return m_totalNsecs;}
+    qint64 maxNsecs()const{return m_maxNsecs;}
+    qint64 meanNsecs()const{return m_count ? m_totalNsecs/m_count : 0;}
+    qint64 bucketValue(int bucket)const{return m_buckets[bucket];}
+    //the (exclusive) upper bound of the given bucket in nanoseconds
+    static qint64 bucketUpperBound(int bucket);
+    //returns the upper bound of the bucket holding the given percentile (0-100) in nanoseconds,
+    //capped by the maximum recorded latency, or 0 if the histogram is empty
+    qint64 percentile(double p)const;
+private:
+    qint64 m_buckets[bucketCount];
+    qint64 m_count;
+    qint64 m_totalNsecs;
+    qint64 m_maxNsecs;
+};
+
+//a snapshot of the statistics of a single connection (see MSqlDatabase::statistics())
+struct MSqlConnectionStatistics {
+    int queueDepth = 0; //number of queries queued or running in the connection's thread (for all its connections, see MSqlDatabase::setSharedThreadCount)
+    qint64 busyNsecs = 0; //time spent executing queries and fetching rows
+    qint64 idleNsecs = 0; //time since the connection was added, not spent executing queries
+    qint64 queriesExecuted = 0;
+    qint64 rowsFetched = 0;
+    //estimated size of the results produced by the connection that are still referenced (by queries, models, user code...)
+    qint64 resultBytes = 0;
+    //execution latency (exec and fetch, without the time spent in the queue) grouped by statement fingerprint,
+    //a fingerprint is the statement's text with literals replaced by "?" and whitespace collapsed,
+    //so that "SELECT * FROM t WHERE id = 1" and "SELECT * FROM t WHERE id=2" are grouped together
+    QHash<QString, MSqlLatencyHistogram> latencies;
+};
+
+//collects the statistics of a single connection
+//counters are updated with atomic operations, and latency histograms are recorded in the connection's thread
+//and published with a try-lock, so that readers never block the connection's thread
+//this class is internal to the library
+class MSqlStatisticsCollector {
+public:
+    //fingerprints with more distinct values than this are grouped under otherFingerprint
+    static const int maxFingerprints = 512;
+    static const QString otherFingerprint;
+    MSqlStatisticsCollector();
+
+    //the following functions must be called from the connection's thread only
+    //records a finished execution of sql, that fetched rows rows and was busy between startedAt and finishedAt
+    //(timestamps of MSqlQueryTimings::now())
+    void recordQuery(const QString& sql, qint64 startedAt, qint64 finishedAt, int rows);
+    //records rows fetched later (eg. by lazy queries)
+    void recordFetch(qint64 startedAt, qint64 finishedAt, int rows);
+
+    //the following functions are thread-safe
+    void resultAllocated(qint64 bytes){m_resultBytes.fetchAndAddRelaxed(bytes);}
+    void resultReleased(qint64 bytes){m_resultBytes.fetchAndAddRelaxed(-bytes);}
+    MSqlConnectionStatistics snapshot()const;
+
+    //normalizes a statement: literals are replaced by "?", lists of "?" are collapsed to a single "?",
+    //comments are removed and tokens are separated by single spaces
+    static QString fingerprint(const QString& sql);
+private:
+    Q_DISABLE_COPY(MSqlStatisticsCollector)
+    QString cachedFingerprint(const QString& sql);
+    void publishLatencies();
+
+    qint64 m_createdAt;
+    QAtomicInteger<qint64> m_busyNsecs;
+    QAtomicInteger<qint64> m_queriesExecuted;
+    QAtomicInteger<qint64> m_rowsFetched;
+    QAtomicInteger<qint64> m_resultBytes;
+    //accessed only from the connection's thread
+    QHash<QString, QString> m_fingerprints; //SQL text -> fingerprint
+    QHash<QString, MSqlLatencyHistogram> m_pendingLatencies; //not published yet
+    //published histograms, written only from the connection's thread while holding m_latenciesMutex
+    mutable QMutex m_latenciesMutex;
+    QHash<QString, MSqlLatencyHistogram> m_latencies;
+};
+
+#endif // MSQLSTATISTICS_H
@@ -1,4 +1,7 @@
 #include "msqlthread.h"
+#include "qthreadutils.h"
+#include "msqlquerytimings.h"
+#include "msqltracer.h"
 
 MSqlThread::MSqlThread(QObject *parent):SafeThread(parent) {
     m_worker = new QObject;
@@ -6,3 +9,48 @@ MSqlThread::MSqlThread(QObject *parent):SafeThread(parent) {
     m_worker->moveToThread(this);
     start();
 }
+
+void MSqlThread::postJob(QObject *context, MSqlPriority::Priority priority, const std::function<void ()> &job) {
+    MSqlTraceScope postScope(true, "thread", "postJob", "job");
+    Job queued;
+    queued.context = context;
+    queued.run = job;
+    queued.queuedAt = MSqlQueryTimings::now();
+    queued.traceId = postScope.startFlow();
+    jobQueued();
+    {
+        QMutexLocker locker(&m_jobsMutex);
+        m_jobs[priority].enqueue(queued);
+    }
+    //every job posts a single event, the event runs whichever job is due at that time (not necessarily this one)
+    PostToWorker(m_worker, [this]{
+        runNextJob();
+    });
+}
+
+void MSqlThread::runNextJob() {
+    Job job;
+    {
+        QMutexLocker locker(&m_jobsMutex);
+        qint64 now = MSqlQueryTimings::now();
+        int next = -1;
+        qint64 nextLevel = -1;
+        //the oldest job of every priority competes, raised by one level for every agingInterval it has waited
+        //on equal levels, the job with the higher priority wins
+        for(int priority = MSqlPriority::Interactive; priority >= MSqlPriority::Background; priority--) {
+            if(m_jobs[priority].isEmpty()) continue;
+            qint64 level = priority + (now - m_jobs[priority].head().queuedAt) / (agingInterval*qint64(1000000));
+            if(level > nextLevel) {
+                next = priority;
+                nextLevel = level;
+            }
+        }
+        if(next == -1) return;
+        job = m_jobs[next].dequeue();
+    }
+    if(job.context) { //the job is dropped if its context has been destroyed
+        MSqlTraceScope runScope(job.traceId != 0, "thread", "run job", "job", job.traceId);
+        job.run();
+    }
+    jobFinished();
+}
@@ -3,6 +3,12 @@
 
 #include <QObject>
 #include <QThread>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QQueue>
+#include <QPointer>
+#include <functional>
+#include "msqlpriority.h"
 
 //a thread that can be destroyed at any time
 //see http://stackoverflow.com/a/25230470
@@ -22,8 +28,44 @@ public:
     ~MSqlThread() {}
 
     QObject* getWorker(){ return m_worker; }
+    
+    //load accounting, used to pick the least-loaded thread of a connection pool
+    //the following functions are thread-safe
+    int load()const{ return m_load.load(); } //number of queries queued or running in this thread
+    int workerCount()const{ return m_workerCount.load(); } //number of query workers living in this thread
+    int connectionCount()const{ return m_connectionCount.load(); } //number of connections pinned to this thread
+    void jobQueued(){ m_load.ref(); }
+    void jobFinished(){ m_load.deref(); }
+    void workerAttached(){ m_workerCount.ref(); }
+    void workerDetached(){ m_workerCount.deref(); }
+    void connectionAttached(){ m_connectionCount.ref(); }
+    void connectionDetached(){ m_connectionCount.deref(); }
+
+    //job scheduling
+    //a job waiting in the queue is raised by one priority level every agingInterval msecs
+    static const int agingInterval = 100;
+    //queues the job to be executed in this thread, and counts it in load() until it finishes
+    //queued jobs are executed highest priority first (taking aging into account), and in the order they have been
+    //posted within the same priority. the job is dropped if context is destroyed before it starts
+    //context must live in this thread, the function is thread-safe
+    void postJob(QObject* context, MSqlPriority::Priority priority, const std::function<void()>& job);
 private:
+    struct Job {
+        QPointer<QObject> context;
+        std::function<void()> run;
+        qint64 queuedAt;
+        quint64 traceId; //the flow linking the post to the run in MSqlTracer, 0 when not traced
+    };
+    //runs in this thread, executes the queued job that should run next
+    void runNextJob();
+
     QObject* m_worker;
+    //queued jobs of every priority, guarded by m_jobsMutex
+    QMutex m_jobsMutex;
+    QQueue<Job> m_jobs[MSqlPriority::Interactive+1];
+    QAtomicInt m_load;
+    QAtomicInt m_workerCount;
+    QAtomicInt m_connectionCount;
 };
 
 #endif // MSQLTHREAD_H
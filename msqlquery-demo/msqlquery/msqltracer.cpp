@@ -0,0 +1,226 @@
+#include "msqltracer.h"
+#include "msqlquerytimings.h"
+#include <QMutex>
+#include <QVector>
+#include <QHash>
+#include <QThread>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QGlobalStatic>
+#include <QAtomicInteger>
+
+namespace {
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    char phase;
+    qint64 timestamp;
+    qint64 duration;
+    int threadId;
+    quint64 flowId;
+    QVariantMap args;
+};
+
+struct TraceThread {
+    int id;
+    QString name;
+};
+
+struct TraceBuffer {
+    QMutex mutex;
+    QVector<TraceEvent> events;
+    QHash<QThread*, TraceThread> threads;
+    int maxEvents = 0;
+    int droppedEvents = 0;
+
+    //must be called while holding the mutex
+    int currentThreadId() {
+        QThread* thread = QThread::currentThread();
+        auto it = threads.constFind(thread);
+        if(it != threads.constEnd())
+            return it.value().id;
+        TraceThread traceThread;
+        traceThread.id = threads.size()+1;
+        traceThread.name = thread->objectName();
+        if(traceThread.name.isEmpty())
+            traceThread.name = QCoreApplication::instance() && thread == QCoreApplication::instance()->thread() ?
+                        QStringLiteral("main") : QStringLiteral("thread %0").arg(traceThread.id);
+        threads.insert(thread, traceThread);
+        return traceThread.id;
+    }
+    void append(TraceEvent& event) {
+        QMutexLocker locker(&mutex);
+        if(!MSqlTracer::isEnabled()) return; //stopped while the event was being recorded
+        if(events.size() >= maxEvents) {
+            droppedEvents++;
+            return;
+        }
+        event.threadId = currentThreadId();
+        events.append(event);
+    }
+};
+Q_GLOBAL_STATIC(TraceBuffer, traceBuffer)
+QAtomicInteger<quint64> lastFlowId;
+}
+
+QAtomicInt MSqlTracer::s_isEnabled;
+
+void MSqlTracer::start(int maxEvents) {
+    QMutexLocker locker(&traceBuffer()->mutex);
+    traceBuffer()->events.clear();
+    traceBuffer()->threads.clear();
+    traceBuffer()->droppedEvents = 0;
+    traceBuffer()->maxEvents = maxEvents;
+    s_isEnabled.store(1);
+}
+
+void MSqlTracer::stop() {
+    s_isEnabled.store(0);
+}
+
+void MSqlTracer::clear() {
+    QMutexLocker locker(&traceBuffer()->mutex);
+    traceBuffer()->events.clear();
+    traceBuffer()->threads.clear();
+    traceBuffer()->droppedEvents = 0;
+}
+
+bool MSqlTracer::write(QIODevice *device) {
+    //events are copied, so that recording threads are not blocked while writing
+    QVector<TraceEvent> events;
+    QList<TraceThread> threads;
+    int droppedEvents;
+    {
+        QMutexLocker locker(&traceBuffer()->mutex);
+        events = traceBuffer()->events;
+        threads = traceBuffer()->threads.values();
+        droppedEvents = traceBuffer()->droppedEvents;
+    }
+    const qint64 pid = QCoreApplication::applicationPid();
+    //a failed or short write fails the whole trace, nothing is written after it
+    bool success = true;
+    auto writeData = [&](const QByteArray& data) {
+        if(success && device->write(data) != data.size())
+            success = false;
+    };
+    auto writeEvent = [&](const QJsonObject& event, bool isFirst) {
+        if(!isFirst) writeData(",\n");
+        writeData(QJsonDocument(event).toJson(QJsonDocument::Compact));
+    };
+    writeData("{\"traceEvents\":[\n");
+    bool isFirst = true;
+    for(const TraceThread& thread : threads) {
+        QJsonObject event;
+        event["name"] = QStringLiteral("thread_name");
+        event["ph"] = QStringLiteral("M");
+        event["pid"] = pid;
+        event["tid"] = thread.id;
+        QJsonObject args;
+        args["name"] = thread.name;
+        event["args"] = args;
+        writeEvent(event, isFirst);
+        isFirst = false;
+    }
+    for(const TraceEvent& traceEvent : events) {
+        QJsonObject event;
+        event["name"] = QLatin1String(traceEvent.name);
+        event["cat"] = QLatin1String(traceEvent.category);
+        event["ph"] = QString(QLatin1Char(traceEvent.phase));
+        event["ts"] = traceEvent.timestamp/1000.0; //microseconds
+        event["pid"] = pid;
+        event["tid"] = traceEvent.threadId;
+        if(traceEvent.phase == 'X') {
+            event["dur"] = traceEvent.duration/1000.0;
+            if(!traceEvent.args.isEmpty())
+                event["args"] = QJsonObject::fromVariantMap(traceEvent.args);
+        } else {
+            event["id"] = QString::number(traceEvent.flowId, 16);
+            if(traceEvent.phase == 'f')
+                event["bp"] = QStringLiteral("e"); //attach to the enclosing slice, rather than the next one
+        }
+        writeEvent(event, isFirst);
+        isFirst = false;
+    }
+    writeData(QStringLiteral("\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%0}}\n")
+              .arg(droppedEvents).toUtf8());
+    return success;
+}
+
+bool MSqlTracer::save(const QString &fileName) {
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return write(&file) && file.flush(); //buffered data that fails to be written is reported by flush()
+}
+
+int MSqlTracer::eventCount() {
+    QMutexLocker locker(&traceBuffer()->mutex);
+    return traceBuffer()->events.size();
+}
+
+int MSqlTracer::droppedEventCount() {
+    QMutexLocker locker(&traceBuffer()->mutex);
+    return traceBuffer()->droppedEvents;
+}
+
+void MSqlTracer::recordSlice(const char *category, const char *name, qint64 startedAt, qint64 finishedAt,
+                             const QVariantMap &args) {
+    if(!isEnabled() || traceBuffer.isDestroyed()) return;
+    TraceEvent event;
+    event.category = category;
+    event.name = name;
+    event.phase = 'X';
+    event.timestamp = startedAt;
+    event.duration = finishedAt - startedAt;
+    event.flowId = 0;
+    event.args = args;
+    traceBuffer()->append(event);
+}
+
+void MSqlTracer::recordFlow(char phase, const char *name, quint64 flowId, qint64 at) {
+    if(!isEnabled() || traceBuffer.isDestroyed()) return;
+    TraceEvent event;
+    event.category = "flow";
+    event.name = name;
+    event.phase = phase;
+    event.timestamp = at;
+    event.duration = 0;
+    event.flowId = flowId;
+    traceBuffer()->append(event);
+}
+
+quint64 MSqlTracer::newFlowId() {
+    return lastFlowId.fetchAndAddRelaxed(1) + 1;
+}
+
+quint64 MSqlTracer::flowId(const void *object, int id) {
+    //the top bit keeps these ids apart from the ones returned by newFlowId()
+    return (Q_UINT64_C(1) << 63) | ((quint64(quintptr(object)) << 20) ^ quint64(quint32(id)));
+}
+
+MSqlTraceScope::MSqlTraceScope(bool isEnabled, const char *category, const char *name, const char *flowName,
+                               quint64 flowEndId)
+    : m_isEnabled(isEnabled && MSqlTracer::isEnabled()), m_category(category), m_name(name), m_flowName(flowName),
+      m_flowEndId(flowEndId), m_flowStartId(0), m_startedAt(0), m_flowStartedAt(0) {
+    if(m_isEnabled)
+        m_startedAt = MSqlQueryTimings::now();
+}
+
+MSqlTraceScope::~MSqlTraceScope() {
+    if(!m_isEnabled) return;
+    qint64 finishedAt = MSqlQueryTimings::now();
+    MSqlTracer::recordSlice(m_category, m_name, m_startedAt, finishedAt, m_args);
+    if(m_flowEndId)
+        MSqlTracer::recordFlow('f', m_flowName, m_flowEndId, m_startedAt);
+    if(m_flowStartId)
+        MSqlTracer::recordFlow('s', m_flowName, m_flowStartId, m_flowStartedAt);
+}
+
+quint64 MSqlTraceScope::startFlow(quint64 flowId) {
+    if(!m_isEnabled) return 0;
+    m_flowStartId = flowId ? flowId : MSqlTracer::newFlowId();
+    m_flowStartedAt = MSqlQueryTimings::now();
+    return m_flowStartId;
+}
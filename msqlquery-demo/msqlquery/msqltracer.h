@@ -0,0 +1,78 @@
+#ifndef MSQLTRACER_H
+#define MSQLTRACER_H
+
+#include <QString>
+#include <QVariantMap>
+#include <QAtomicInt>
+
+class QIODevice;
+
+//records the execution of queries across threads, and writes it in the Chrome trace-event format
+//(open the file in chrome://tracing or https://ui.perfetto.dev to see it as a timeline)
+//the following are recorded while the tracer is started:
+//  - jobs queued on connection threads (see MSqlThread::postJob: queries, transactions, write buffer batches,
+//    bulk load chunks...), as a slice in the posting thread and a slice in the connection's thread, linked by an arrow
+//  - the phases (prepare, exec, fetch) of every query in the connection's thread
+//  - the delivery of the results to the client thread, or the time the client thread is blocked by exec()
+//the phases of a query are linked (by arrows) from its submission to its delivery
+//connection threads are named after the names their connections are registered with in QSqlDatabase, eg. "reports"
+//for MSqlDatabase::addDatabase("QSQLITE", "reports"), "reports_msqlpool_1" for the second connection of its pool,
+//and "msqlquery_shared_0" for the first shared thread (see MSqlDatabase::setSharedThreadCount)
+//
+//tracing is disabled by default, and costs a single atomic load per recording point in that case
+//when enabled, recording takes a lock shared by all threads, so it should be used for diagnosis only
+//all functions are thread-safe
+class MSqlTracer {
+public:
+    //clears any recorded events and starts recording, at most maxEvents are kept (later events are dropped)
+    static void start(int maxEvents = 1000000);
+    static void stop();
+    static bool isEnabled(){ return s_isEnabled.load() != 0; }
+    static void clear();
+    //writes the recorded events as a Chrome trace-event JSON object, the tracer can be running meanwhile
+    //returns false if the device fails to write all of the data
+    static bool write(QIODevice* device);
+    static bool save(const QString& fileName);
+    //the number of events recorded (and dropped because maxEvents has been reached) since the last start()/clear()
+    static int eventCount();
+    static int droppedEventCount();
+
+    //the following functions are used by the library to record events
+    //timestamps are taken with MSqlQueryTimings::now()
+    static void recordSlice(const char* category, const char* name, qint64 startedAt, qint64 finishedAt,
+                            const QVariantMap& args = QVariantMap());
+    //phase is 's' (flow start), 't' (flow step) or 'f' (flow end), a flow event is attached to the slice
+    //that encloses it in the same thread
+    static void recordFlow(char phase, const char* name, quint64 flowId, qint64 at);
+    static quint64 newFlowId();
+    //a flow id derived from an object and an id (eg. a query object and its query id)
+    static quint64 flowId(const void* object, int id);
+private:
+    static QAtomicInt s_isEnabled;
+};
+
+//records a slice from its construction to its destruction in the current thread, if enabled
+//it can end a flow at its start, and start a flow (see MSqlTracer::recordFlow)
+//this class is internal to the library
+class MSqlTraceScope {
+public:
+    MSqlTraceScope(bool isEnabled, const char* category, const char* name, const char* flowName = nullptr,
+                   quint64 flowEndId = 0);
+    ~MSqlTraceScope();
+    //starts a flow from the current time, returns its id (a new id if flowId is 0)
+    quint64 startFlow(quint64 flowId = 0);
+    void setArgs(const QVariantMap& args){ m_args = args; }
+private:
+    Q_DISABLE_COPY(MSqlTraceScope)
+    bool m_isEnabled;
+    const char* m_category;
+    const char* m_name;
+    const char* m_flowName;
+    quint64 m_flowEndId;
+    quint64 m_flowStartId;
+    qint64 m_startedAt;
+    qint64 m_flowStartedAt;
+    QVariantMap m_args;
+};
+
+#endif // MSQLTRACER_H
@@ -0,0 +1,150 @@
+#include "msqltransaction.h"
+#include "msqlconnection.h"
+#include "msqlstatistics.h"
+#include "msqlquerytimings.h"
+#include <QSqlDatabase>
+#include <QFutureInterface>
+
+MSqlTransaction::MSqlTransaction(QObject *parent, MSqlDatabase db)
+    : QObject(parent), db(db) {
+    connect(&m_watcher, &QFutureWatcherBase::finished, this, &MSqlTransaction::watcherFinished);
+}
+
+int MSqlTransaction::addQuery(const QString &query, const QVariantList &positionalBinds) {
+    Statement statement;
+    statement.query = query;
+    statement.positionalBinds = positionalBinds;
+    m_statements.append(statement);
+    return m_statements.size()-1;
+}
+
+int MSqlTransaction::addQuery(const QString &query, const QVariantMap &placeHolderBinds) {
+    Statement statement;
+    statement.query = query;
+    statement.placeHolderBinds = placeHolderBinds;
+    m_statements.append(statement);
+    return m_statements.size()-1;
+}
+
+int MSqlTransaction::addBatchQuery(const QString &query, const QVariantList &batchBinds, QSqlQuery::BatchExecutionMode mode) {
+    Statement statement;
+    statement.query = query;
+    statement.positionalBinds = batchBinds;
+    statement.isBatch = true;
+    statement.batchMode = mode;
+    m_statements.append(statement);
+    return m_statements.size()-1;
+}
+
+void MSqlTransaction::clear() {
+    m_statements.clear();
+}
+
+int MSqlTransaction::queryCount() const {
+    return m_statements.size();
+}
+
+void MSqlTransaction::setPriority(MSqlPriority::Priority priority) {
+    m_priority = priority;
+}
+
+MSqlPriority::Priority MSqlTransaction::priority() const {
+    return m_priority;
+}
+
+QFuture<MSqlResult> MSqlTransaction::execAsync() {
+    //the whole transaction is executed on a single connection (the least-loaded one in a pool)
+    QString connectionName = db.connectionName();
+    QList<Statement> statements = m_statements;
+    QSharedPointer<Outcome> outcome(new Outcome);
+    QFutureInterface<MSqlResult> futureInterface;
+    futureInterface.reportStarted();
+    bool isPosted = MSqlDatabase::postToConnection(connectionName, MSqlDatabase::connectionIndexForQuery(connectionName),
+                                                   m_priority, [=](MSqlConnection* connection){
+        QFutureInterface<MSqlResult> jobInterface = futureInterface;
+        execTransaction(connection->qtConnectionName(), connection->statistics(), statements, outcome.data(), jobInterface);
+        jobInterface.reportFinished();
+    });
+    if(!isPosted) { //the connection name has not been added (see MSqlDatabase::addDatabase)
+        outcome->error = MSqlDatabase::noConnectionError(connectionName);
+        futureInterface.reportFinished();
+    }
+    bool wasBusy = isBusy();
+    m_pendingOutcome = outcome;
+    m_watcher.setFuture(futureInterface.future());
+    if(!wasBusy)
+        emit busyToggled(true);
+    return futureInterface.future();
+}
+
+bool MSqlTransaction::isBusy() const {
+    return m_watcher.isRunning();
+}
+
+QSqlError MSqlTransaction::lastError() const {
+    return m_outcome.error;
+}
+
+int MSqlTransaction::failedQueryIndex() const {
+    return m_outcome.failedQueryIndex;
+}
+
+QList<MSqlResult> MSqlTransaction::results() const {
+    return m_results;
+}
+
+void MSqlTransaction::execTransaction(const QString &qtConnectionName, const QSharedPointer<MSqlStatisticsCollector> &statistics,
+                                      const QList<Statement> &statements, Outcome *outcome,
+                                      QFutureInterface<MSqlResult> &futureInterface) {
+    QSqlDatabase qdb = QSqlDatabase::database(qtConnectionName, false);
+    if(!qdb.transaction()) {
+        outcome->error = qdb.lastError();
+        return;
+    }
+    { //the query must be destroyed before committing, as some drivers refuse to commit while statements are active
+        QSqlQuery q(qdb);
+        q.setForwardOnly(true);
+        for(int i=0; i<statements.size(); i++) {
+            const Statement& statement = statements.at(i);
+            qint64 startedAt = MSqlQueryTimings::now();
+            bool success = q.prepare(statement.query);
+            if(success) {
+                for(const QVariant& val : statement.positionalBinds)
+                    q.addBindValue(val);
+                for(auto j = statement.placeHolderBinds.constBegin(); j != statement.placeHolderBinds.constEnd(); ++j)
+                    q.bindValue(j.key(), j.value());
+                success = statement.isBatch ? q.execBatch(statement.batchMode) : q.exec();
+            }
+            MSqlResultBuilder builder(q.record());
+            builder.setStatistics(statistics);
+            if(success) {
+                builder.setLastInsertId(q.lastInsertId());
+                while(q.next())
+                    builder.appendRow(q);
+            } else {
+                builder.setLastError(q.lastError());
+            }
+            statistics->recordQuery(statement.query, startedAt, MSqlQueryTimings::now(), builder.rowCount());
+            futureInterface.reportResult(builder.take(), i);
+            if(!success) { //skip remaining statements, and roll back
+                outcome->error = q.lastError();
+                outcome->failedQueryIndex = i;
+                q.clear();
+                qdb.rollback();
+                return;
+            }
+            q.finish();
+        }
+    }
+    if(!qdb.commit()) {
+        outcome->error = qdb.lastError();
+        qdb.rollback();
+    }
+}
+
+void MSqlTransaction::watcherFinished() {
+    m_outcome = *m_pendingOutcome;
+    m_results = m_watcher.future().results();
+    emit finished(m_outcome.error.type() == QSqlError::NoError);
+    emit busyToggled(false);
+}
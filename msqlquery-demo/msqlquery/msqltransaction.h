@@ -0,0 +1,96 @@
+#ifndef MSQLTRANSACTION_H
+#define MSQLTRANSACTION_H
+
+#include <QObject>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QSharedPointer>
+#include <QFuture>
+#include <QFutureWatcher>
+#include "msqldatabase.h"
+#include "msqlresult.h"
+#include "msqlpriority.h"
+
+class MSqlStatisticsCollector;
+
+//collects several SQL statements (with their binds), and executes them in a single transaction asynchronously
+//begin, all statements and commit are executed as one job in the connection's thread (without any round trips
+//to the calling thread), if any statement fails, the transaction is rolled back and the remaining statements are skipped
+//
+//example:
+//  MSqlTransaction* t = new MSqlTransaction(this);
+//  t->addQuery("INSERT INTO accounts(name) VALUES(?)", QVariantList() << "user");
+//  t->addQuery("UPDATE stats SET accountCount = accountCount + 1");
+//  connect(t, &MSqlTransaction::finished, this, &MyClass::transactionFinished);
+//  t->execAsync();
+class MSqlTransaction : public QObject {
+    Q_OBJECT
+public:
+    explicit MSqlTransaction(QObject* parent = 0, MSqlDatabase db = MSqlDatabase::database());
+
+    //the following functions append a statement to the transaction, and return its index
+    //positional binds are bound in order (as with QSqlQuery::addBindValue)
+    int addQuery(const QString& query, const QVariantList& positionalBinds = QVariantList());
+    //placeholder binds map each placeholder (eg. ":name") to its value (as with QSqlQuery::bindValue)
+    int addQuery(const QString& query, const QVariantMap& placeHolderBinds);
+    //every item in batchBinds is a QVariantList holding the values of one positional placeholder (see QSqlQuery::execBatch)
+    int addBatchQuery(const QString& query, const QVariantList& batchBinds,
+                      QSqlQuery::BatchExecutionMode mode = QSqlQuery::ValuesAsRows);
+    //removes all statements, statements already submitted using execAsync() are not affected
+    void clear();
+    int queryCount()const;
+    //the priority of the following transactions in the connection's thread (see MSqlPriority), Normal by default
+    void setPriority(MSqlPriority::Priority priority);
+    MSqlPriority::Priority priority()const;
+
+    //submits the statements added so far to the connection's thread
+    //the returned future reports one MSqlResult for every executed statement (in order), use QFuture::resultAt()
+    //or QFuture::results() to get them. when a statement fails, its result (holding the error) is the last one reported
+    //the statements are executed even if this object is destroyed before they finish
+    QFuture<MSqlResult> execAsync();
+    bool isBusy()const;
+
+    //the following functions return information about the last finished transaction
+    //the error that caused the transaction to fail (QSqlError::NoError if the transaction was committed)
+    QSqlError lastError()const;
+    //the index of the statement that caused the transaction to be rolled back,
+    //or -1 if the transaction was committed, or if beginning/committing the transaction failed
+    int failedQueryIndex()const;
+    QList<MSqlResult> results()const;
+signals:
+    //emitted when the transaction is committed (success = true), or rolled back (success = false)
+    void finished(bool success);
+    void busyToggled(bool isBusy);
+private:
+    struct Statement {
+        QString query;
+        QVariantList positionalBinds;
+        QVariantMap placeHolderBinds;
+        bool isBatch = false;
+        QSqlQuery::BatchExecutionMode batchMode = QSqlQuery::ValuesAsRows;
+    };
+    //written in the connection's thread before the transaction's future finishes,
+    //read in the client thread only after that
+    struct Outcome {
+        QSqlError error;
+        int failedQueryIndex = -1;
+    };
+    //runs in the connection's thread
+    static void execTransaction(const QString& qtConnectionName, const QSharedPointer<MSqlStatisticsCollector>& statistics,
+                                const QList<Statement>& statements, Outcome* outcome,
+                                QFutureInterface<MSqlResult>& futureInterface);
+    void watcherFinished();
+
+    MSqlDatabase db;
+    QList<Statement> m_statements;
+    MSqlPriority::Priority m_priority = MSqlPriority::Normal;
+    QFutureWatcher<MSqlResult> m_watcher;
+    //the outcome of the transaction being watched by m_watcher
+    QSharedPointer<Outcome> m_pendingOutcome;
+    //the last finished transaction, accessed only from the client thread
+    Outcome m_outcome;
+    QList<MSqlResult> m_results;
+};
+
+#endif // MSQLTRANSACTION_H
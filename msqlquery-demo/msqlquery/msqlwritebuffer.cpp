@@ -0,0 +1,189 @@
+#include "msqlwritebuffer.h"
+#include "msqlconnection.h"
+#include "msqlstatementcache.h"
+#include "msqlstatistics.h"
+#include "msqlquerytimings.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QFutureInterface>
+#include <QMutex>
+#include <QVector>
+#include <QTimer>
+
+struct MSqlWriteBuffer::State {
+    QString statement;
+    //the connection is looked up for every batch (by its position in the pool), as it can be replaced
+    QString connectionName;
+    int connectionIndex;
+    QAtomicInt maxRows;
+    QAtomicInt maxDelay;
+    //the pending batch, guarded by mutex
+    mutable QMutex mutex;
+    QVector<QVariantList> columns; //the values of every placeholder, as expected by QSqlQuery::execBatch()
+    int rowCount = 0;
+    int batchId = 0; //incremented on every flush, so that the timer of a flushed batch is ignored
+    QFutureInterface<MSqlResult> batch;
+};
+
+//returns a future that is already finished with the given result
+static QFuture<MSqlResult> finishedFuture(const MSqlResult& result) {
+    QFutureInterface<MSqlResult> futureInterface;
+    futureInterface.reportStarted();
+    futureInterface.reportResult(result);
+    futureInterface.reportFinished();
+    return futureInterface.future();
+}
+
+//finishes the batch with the given error
+static void failBatch(QFutureInterface<MSqlResult>& batch, const QSqlError& error) {
+    MSqlResultBuilder builder((QSqlRecord()));
+    builder.setLastError(error);
+    batch.reportResult(builder.take());
+    batch.reportFinished();
+}
+
+//runs in the connection's thread
+static void writeBatch(MSqlConnection* connection, const QString& statement, const QVector<QVariantList>& columns,
+                       QFutureInterface<MSqlResult>& batch) {
+    qint64 startedAt = MSqlQueryTimings::now();
+    QSqlDatabase db = QSqlDatabase::database(connection->qtConnectionName(), false);
+    MSqlResultBuilder builder((QSqlRecord()));
+    if(!db.transaction()) {
+        builder.setLastError(db.lastError());
+    } else {
+        QSqlQuery ownQuery(db);
+        QSqlQuery* query = connection->statementCache()->prepared(statement);
+        if(!query) { //the statement is not cached (or has failed to prepare, ownQuery reports the error in that case)
+            query = &ownQuery;
+            query->prepare(statement);
+        }
+        for(const QVariantList& column : columns)
+            query->addBindValue(column);
+        bool success = query->execBatch();
+        if(!success)
+            builder.setLastError(query->lastError());
+        query->finish();
+        if(!success) {
+            db.rollback();
+        } else if(!db.commit()) {
+            builder.setLastError(db.lastError());
+            db.rollback();
+        }
+    }
+    connection->statistics()->recordQuery(statement, startedAt, MSqlQueryTimings::now(), 0);
+    batch.reportResult(builder.take());
+    batch.reportFinished();
+}
+
+MSqlWriteBuffer::MSqlWriteBuffer(const QString &statement, MSqlDatabase db)
+    : m_state(new State) {
+    m_state->statement = statement;
+    m_state->connectionName = db.connectionName();
+    m_state->connectionIndex = MSqlDatabase::connectionIndexForQuery(db.connectionName());
+    m_state->maxRows.store(defaultMaxRows);
+    m_state->maxDelay.store(defaultMaxDelay);
+    m_state->batch.reportStarted();
+}
+
+MSqlWriteBuffer::~MSqlWriteBuffer() {
+    flush();
+}
+
+QString MSqlWriteBuffer::statement() const {
+    return m_state->statement;
+}
+
+void MSqlWriteBuffer::setMaxRows(int rows) {
+    m_state->maxRows.store(qMax(rows, 1));
+}
+
+int MSqlWriteBuffer::maxRows() const {
+    return m_state->maxRows.load();
+}
+
+void MSqlWriteBuffer::setMaxDelay(int msecs) {
+    m_state->maxDelay.store(qMax(msecs, 0));
+}
+
+int MSqlWriteBuffer::maxDelay() const {
+    return m_state->maxDelay.load();
+}
+
+QFuture<MSqlResult> MSqlWriteBuffer::addRow(const QVariantList &values) {
+    QSharedPointer<State> state = m_state;
+    int batchId;
+    bool isFirstRow;
+    bool isFull;
+    QFuture<MSqlResult> future;
+    {
+        QMutexLocker locker(&state->mutex);
+        if(state->rowCount > 0 && values.size() != state->columns.size()) {
+            MSqlResultBuilder builder((QSqlRecord()));
+            builder.setLastError(QSqlError(QString(), QStringLiteral("the row holds %0 values, but previous rows hold %1 values")
+                                           .arg(values.size()).arg(state->columns.size()), QSqlError::StatementError));
+            return finishedFuture(builder.take());
+        }
+        if(state->rowCount == 0)
+            state->columns = QVector<QVariantList>(values.size());
+        for(int i=0; i<values.size(); i++)
+            state->columns[i].append(values.at(i));
+        state->rowCount++;
+        batchId = state->batchId;
+        isFirstRow = state->rowCount == 1;
+        isFull = state->rowCount >= state->maxRows.load();
+        future = state->batch.future();
+    }
+    if(isFull) {
+        flushBatch(state, batchId);
+    } else if(isFirstRow) {
+        //the timer is started in the connection's thread, as the calling thread may not have an event loop
+        int maxDelay = state->maxDelay.load();
+        bool isPosted = MSqlDatabase::postToConnection(state->connectionName, state->connectionIndex,
+                                                       MSqlPriority::Interactive, [=](MSqlConnection*){
+            QTimer::singleShot(maxDelay, [=]{
+                flushBatch(state, batchId);
+            });
+        });
+        if(!isPosted) //the batch fails now, rather than waiting for the next flush
+            flushBatch(state, batchId);
+    }
+    return future;
+}
+
+QFuture<MSqlResult> MSqlWriteBuffer::flush() {
+    return flushBatch(m_state);
+}
+
+int MSqlWriteBuffer::pendingRows() const {
+    QMutexLocker locker(&m_state->mutex);
+    return m_state->rowCount;
+}
+
+QFuture<MSqlResult> MSqlWriteBuffer::flushBatch(const QSharedPointer<State> &state, int batchId) {
+    QVector<QVariantList> columns;
+    QFutureInterface<MSqlResult> batch;
+    {
+        QMutexLocker locker(&state->mutex);
+        if(batchId != -1 && batchId != state->batchId) //the batch has already been flushed
+            return QFuture<MSqlResult>();
+        if(state->rowCount == 0)
+            return finishedFuture(MSqlResult());
+        columns.swap(state->columns);
+        batch = state->batch;
+        state->rowCount = 0;
+        state->batchId++;
+        state->batch = QFutureInterface<MSqlResult>();
+        state->batch.reportStarted();
+    }
+    QString statement = state->statement;
+    //batches are posted (even from the connection's thread), so that they are executed in the order they are flushed
+    //they are background jobs, so that interactive queries do not wait behind them
+    bool isPosted = MSqlDatabase::postToConnection(state->connectionName, state->connectionIndex,
+                                                   MSqlPriority::Background, [=](MSqlConnection* connection){
+        QFutureInterface<MSqlResult> jobBatch = batch;
+        writeBatch(connection, statement, columns, jobBatch);
+    });
+    if(!isPosted)
+        failBatch(batch, MSqlDatabase::noConnectionError(state->connectionName));
+    return batch.future();
+}
@@ -0,0 +1,57 @@
+#ifndef MSQLWRITEBUFFER_H
+#define MSQLWRITEBUFFER_H
+
+#include <QString>
+#include <QVariant>
+#include <QFuture>
+#include <QSharedPointer>
+#include "msqldatabase.h"
+#include "msqlresult.h"
+
+//collects rows for a single statement (eg. "INSERT INTO events(time, name) VALUES(?, ?)") from any thread,
+//and writes them in batches: a batch is executed with QSqlQuery::execBatch() inside a transaction
+//in the connection's thread, using the connection's prepared statement cache
+//a batch is flushed when it holds maxRows() rows, or maxDelay() msecs after its first row has been added,
+//so that many small inserts cost a single post to the connection's thread, a single execution and a single commit
+//
+//batches are executed on a single connection (picked when the buffer is constructed), in the order they are flushed
+//if the connection is replaced (see MSqlDatabase::addDatabase), the next batches are executed on the connection
+//that replaces it (at the same position in the pool), and fail if there is none
+//
+//example:
+//  MSqlWriteBuffer buffer("INSERT INTO events(time, name) VALUES(?, ?)");
+//  buffer.addRow(QVariantList() << QDateTime::currentDateTime() << "started"); //from any thread
+class MSqlWriteBuffer {
+public:
+    static const int defaultMaxRows = 500;
+    static const int defaultMaxDelay = 50;
+    explicit MSqlWriteBuffer(const QString& statement, MSqlDatabase db = MSqlDatabase::database());
+    //flushes the pending rows (without waiting for them to be written)
+    ~MSqlWriteBuffer();
+
+    QString statement()const;
+    //all the following functions are thread-safe
+    //the new thresholds apply to the next batch
+    void setMaxRows(int rows);
+    int maxRows()const;
+    void setMaxDelay(int msecs);
+    int maxDelay()const;
+
+    //appends a row holding a value for every placeholder of the statement (in order)
+    //the returned future finishes when the batch holding the row has been committed (or rolled back),
+    //its result is empty and holds the error of the batch (if any). all rows of a batch fail or succeed together
+    QFuture<MSqlResult> addRow(const QVariantList& values);
+    //flushes the pending rows now, the returned future is the one returned by addRow() for these rows
+    QFuture<MSqlResult> flush();
+    int pendingRows()const;
+private:
+    Q_DISABLE_COPY(MSqlWriteBuffer)
+    struct State;
+    //takes the pending batch (if batchId is the pending batch's id, or if batchId is -1)
+    //and posts it to the connection's thread
+    static QFuture<MSqlResult> flushBatch(const QSharedPointer<State>& state, int batchId = -1);
+    //shared with the jobs and timers posted to the connection's thread, as they may outlive the buffer
+    QSharedPointer<State> m_state;
+};
+
+#endif // MSQLWRITEBUFFER_H
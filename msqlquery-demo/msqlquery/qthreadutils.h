@@ -28,6 +28,8 @@ void PostToWorker(QObject* worker, Func&& f, Qt::ConnectionType connectionType =
 template <typename Func> //for functors returning non-void
 typename std::enable_if<!std::is_void<typename FunctorTraits<Func>::return_t>::value, typename FunctorTraits<Func>::return_t>::type
 CallByWorker(QObject* worker, Func&& f) {
+    if(!worker) //eg. the worker of a connection name that has not been added, the functor is not called
+        return typename FunctorTraits<Func>::return_t();
     Qt::ConnectionType blockingConnectionType = QThread::currentThread() == worker->thread() ?
                 Qt::DirectConnection : Qt::BlockingQueuedConnection;
     typename FunctorTraits<Func>::return_t returnValue;
@@ -41,6 +43,7 @@ CallByWorker(QObject* worker, Func&& f) {
 template <typename Func> //for functors returning void
 typename std::enable_if<std::is_void<typename FunctorTraits<Func>::return_t>::value, void>::type
 CallByWorker(QObject* worker, Func&& f) {
+    if(!worker) return; //eg. the worker of a connection name that has not been added, the functor is not called
     Qt::ConnectionType blockingConnectionType = QThread::currentThread() == worker->thread() ?
                 Qt::DirectConnection : Qt::BlockingQueuedConnection;
     PostToWorker(worker, std::forward<Func>(f), blockingConnectionType);
@@ -39,8 +39,8 @@ void QueryDemoWidget::showResults(bool success) {
         int rowCount = 0;
         while(m_query->next() && rowCount++<10) { //loop to display first 10 records
             QString recordStr;
-            for(int i=0; i<m_query->record().count(); i++)
-                recordStr+= m_query->record().value(i).toString()+ "\t";
+            for(int i=0; i<m_query->result().columnCount(); i++)
+                recordStr+= m_query->value(i).toString()+ "\t";
             recordStr.append("\n");
             ui->teResults->append(recordStr);
         }
@@ -0,0 +1,218 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <algorithm>
+#include "msqldatabase.h"
+#include "msqlquery.h"
+
+static const QString connectionName = QStringLiteral("msqlquery_stress");
+static const int tableRowCount = 10000;
+
+//a client thread, it keeps executing queries until the deadline, and records the latency of every query
+class ClientThread : public QThread {
+public:
+    ClientThread(qint64 durationMsecs, bool isQueryReused)
+        :m_durationMsecs(durationMsecs), m_isQueryReused(isQueryReused) {}
+    QVector<qint64> latencies; //in nanoseconds
+    int failures = 0;
+protected:
+    void run() override {
+        MSqlDatabase db = MSqlDatabase::database(connectionName);
+        MSqlQuery* reusedQuery = m_isQueryReused ? new MSqlQuery(nullptr, db) : nullptr;
+        QElapsedTimer deadline;
+        deadline.start();
+        QElapsedTimer timer;
+        int id = 0;
+        while(deadline.elapsed() < m_durationMsecs) {
+            timer.start();
+            //creating a query object for every query exercises the connections registry, like short-lived queries do
+            MSqlQuery* query = reusedQuery ? reusedQuery : new MSqlQuery(nullptr, db);
+            query->prepare("select id, name, value from items where id = ?");
+            query->addBindValue(id);
+            if(!query->exec())
+                failures++;
+            if(!reusedQuery)
+                delete query;
+            latencies.append(timer.nsecsElapsed());
+            id = (id + 7919) % tableRowCount; //spread the queries over the table
+        }
+        delete reusedQuery;
+    }
+private:
+    qint64 m_durationMsecs;
+    bool m_isQueryReused;
+};
+
+struct RunResult {
+    int connections;
+    int threads;
+    int queries;
+    int failures;
+    double throughput; //queries per second
+    qint64 p50, p95, p99, max; //latency in microseconds
+    int connectionsLockContentions;
+    int workerLockContentions;
+};
+
+static qint64 percentile(const QVector<qint64>& sortedLatencies, double p) {
+    if(sortedLatencies.isEmpty()) return 0;
+    int index = qMin(int(p * sortedLatencies.size()), sortedLatencies.size()-1);
+    return sortedLatencies.at(index) / 1000;
+}
+
+static bool setupDatabase(const QString& databasePath, int connections) {
+    //all connections in the pool open the same database file
+    MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", connectionName, connections);
+    db.setDatabaseName(databasePath);
+    if(!db.open()) return false;
+    MSqlQuery query(nullptr, db);
+    if(!query.exec("create table if not exists items (id integer primary key, name varchar(20), value integer)"))
+        return false;
+    if(!query.exec("select count(*) from items") || !query.next())
+        return false;
+    if(query.value(0).toInt() == tableRowCount) return true;
+    QVariantList ids;
+    QVariantList names;
+    QVariantList values;
+    for(int i=0; i<tableRowCount; i++) {
+        ids << i;
+        names << QString("item%0").arg(i);
+        values << i*3;
+    }
+    query.prepare("insert into items(id, name, value) values(?, ?, ?)");
+    query.addBindValue(ids);
+    query.addBindValue(names);
+    query.addBindValue(values);
+    return query.execBatch();
+}
+
+static RunResult runStress(int connections, int threads, qint64 durationMsecs, bool isQueryReused) {
+    int connectionsLockContentions = MSqlDatabase::connectionsLockContentions();
+    int workerLockContentions = MSqlDatabase::workerLockContentions();
+    QVector<ClientThread*> clients;
+    for(int i=0; i<threads; i++)
+        clients.append(new ClientThread(durationMsecs, isQueryReused));
+    QElapsedTimer timer;
+    timer.start();
+    for(ClientThread* client : clients)
+        client->start();
+    for(ClientThread* client : clients)
+        client->wait();
+    qint64 elapsedNsecs = timer.nsecsElapsed();
+    RunResult result;
+    result.connections = connections;
+    result.threads = threads;
+    result.failures = 0;
+    QVector<qint64> latencies;
+    for(ClientThread* client : clients) {
+        latencies += client->latencies;
+        result.failures += client->failures;
+    }
+    qDeleteAll(clients);
+    std::sort(latencies.begin(), latencies.end());
+    result.queries = latencies.size();
+    result.throughput = elapsedNsecs > 0 ? latencies.size() * 1e9 / elapsedNsecs : 0;
+    result.p50 = percentile(latencies, 0.50);
+    result.p95 = percentile(latencies, 0.95);
+    result.p99 = percentile(latencies, 0.99);
+    result.max = latencies.isEmpty() ? 0 : latencies.last() / 1000;
+    result.connectionsLockContentions = MSqlDatabase::connectionsLockContentions() - connectionsLockContentions;
+    result.workerLockContentions = MSqlDatabase::workerLockContentions() - workerLockContentions;
+    return result;
+}
+
+static QList<int> parseIntList(const QString& str) {
+    QList<int> list;
+    for(const QString& item : str.split(',', QString::SkipEmptyParts)) {
+        int value = item.toInt();
+        if(value > 0) list.append(value);
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs queries from many client threads against an MSqlDatabase connection pool.");
+    parser.addHelpOption();
+    QCommandLineOption threadsOption("threads", "Comma-separated numbers of client threads.", "list", "1,2,4,8");
+    QCommandLineOption connectionsOption("connections", "Comma-separated pool sizes.", "list", "1,2,4");
+    QCommandLineOption durationOption("duration", "Duration of every run in seconds.", "seconds", "2");
+    QCommandLineOption formatOption("format", "Output format: csv or json.", "format", "csv");
+    QCommandLineOption outputOption("output", "Output file (standard output by default).", "file");
+    QCommandLineOption reuseOption("reuse-queries", "Reuse one MSqlQuery per client thread instead of creating one per query.");
+    parser.addOptions({threadsOption, connectionsOption, durationOption, formatOption, outputOption, reuseOption});
+    parser.process(a);
+
+    QList<int> threadCounts = parseIntList(parser.value(threadsOption));
+    QList<int> connectionCounts = parseIntList(parser.value(connectionsOption));
+    qint64 durationMsecs = qint64(parser.value(durationOption).toDouble() * 1000);
+    bool isQueryReused = parser.isSet(reuseOption);
+
+    QTemporaryDir dir;
+    if(!dir.isValid()) {
+        qCritical("cannot create a temporary directory for the database");
+        return 1;
+    }
+    QString databasePath = dir.filePath("stress.sqlite");
+
+    QList<RunResult> results;
+    for(int connections : connectionCounts) {
+        if(!setupDatabase(databasePath, connections)) {
+            qCritical("cannot set up the database: %s", qPrintable(MSqlDatabase::database(connectionName).lastError().text()));
+            return 2;
+        }
+        for(int threads : threadCounts)
+            results.append(runStress(connections, threads, durationMsecs, isQueryReused));
+    }
+
+    QFile file;
+    if(parser.isSet(outputOption)) {
+        file.setFileName(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            qCritical("cannot open %s", qPrintable(file.fileName()));
+            return 3;
+        }
+    } else {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    QTextStream out(&file);
+    if(parser.value(formatOption) == "json") {
+        QJsonArray array;
+        for(const RunResult& result : results) {
+            QJsonObject object;
+            object["connections"] = result.connections;
+            object["threads"] = result.threads;
+            object["queries"] = result.queries;
+            object["failures"] = result.failures;
+            object["throughput_qps"] = result.throughput;
+            object["latency_p50_us"] = double(result.p50);
+            object["latency_p95_us"] = double(result.p95);
+            object["latency_p99_us"] = double(result.p99);
+            object["latency_max_us"] = double(result.max);
+            object["connections_lock_contentions"] = result.connectionsLockContentions;
+            object["worker_lock_contentions"] = result.workerLockContentions;
+            array.append(object);
+        }
+        out << QJsonDocument(array).toJson();
+    } else {
+        out << "connections,threads,queries,failures,throughput_qps,latency_p50_us,latency_p95_us,"
+               "latency_p99_us,latency_max_us,connections_lock_contentions,worker_lock_contentions\n";
+        for(const RunResult& result : results) {
+            out << result.connections << ',' << result.threads << ',' << result.queries << ','
+                << result.failures << ',' << QString::number(result.throughput, 'f', 1) << ','
+                << result.p50 << ',' << result.p95 << ',' << result.p99 << ',' << result.max << ','
+                << result.connectionsLockContentions << ',' << result.workerLockContentions << '\n';
+        }
+    }
+    return 0;
+}
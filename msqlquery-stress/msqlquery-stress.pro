@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# MSqlQuery stress benchmark:
+#----------------------------
+# a console application that runs queries from many client threads against a connection pool,
+# for every combination of client threads and pool size, it reports the throughput, the latency
+# percentiles, and the contention on the library's internal locks, eg.:
+#   ./msqlquery-stress --threads 1,2,4,8,16 --connections 1,2,4 --duration 3 --format json
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+include(../msqlquery-demo/msqlquery/msqlquery.pri)
+
+TARGET = msqlquery-stress
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+
+SOURCES += main.cpp
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# MSqlQuery tests:
+#------------------
+# a headless QTest suite checking the behavior of the async layer (results delivered across threads,
+# scheduling and connection management), using SQLite
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+include(../msqlquery-demo/msqlquery/msqlquery.pri)
+
+TARGET = msqlquery-tests
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+
+SOURCES += tst_msqlquery.cpp
@@ -0,0 +1,411 @@
+#include <QtTest>
+#include <QSemaphore>
+#include <QBuffer>
+#include <QSharedPointer>
+#include <QTemporaryDir>
+#include "msqldatabase.h"
+#include "msqlquery.h"
+#include "msqlquerymodel.h"
+#include "msqlthread.h"
+#include "msqlwritebuffer.h"
+#include "msqlbulkloader.h"
+#include "msqltracer.h"
+#include "qthreadutils.h"
+
+//most tests use their own in-memory connection, filled with a table of tableRowCount rows
+static const QString connectionName = QStringLiteral("msqlquery_tests");
+static const int tableRowCount = 100;
+
+//blocks the thread of a connection until release() is called (or the blocker is destroyed),
+//so that the order in which queued work runs can be checked
+class ThreadBlocker {
+public:
+    //the semaphore is shared with the blocking job, which may still be waking up when the blocker is destroyed
+    explicit ThreadBlocker(QObject* context): m_released(new QSemaphore) {
+        QSharedPointer<QSemaphore> released = m_released;
+        PostToWorker(context, [released]{
+            released->acquire();
+        });
+    }
+    ~ThreadBlocker(){ release(); }
+    void release() {
+        if(!m_isReleased)
+            m_released->release();
+        m_isReleased = true;
+    }
+private:
+    QSharedPointer<QSemaphore> m_released;
+    bool m_isReleased = false;
+};
+
+class MSqlQueryTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void unknownConnection();
+    void execAsyncDeliversResults();
+    void modelResetsOnEveryExecution();
+    void pipelinedPlaceholderBinds();
+    void cachedStatementDropsBinds();
+    void overwrittenQueryIsCanceled();
+    void singleFlightSharesExecution();
+    void routedReads();
+    void priorityOrder();
+    void priorityAging();
+    void newWorkerRunsFirstJob();
+    void sharedThreads();
+    void tracerFailsOnFailedWrites();
+    void replacedConnection();
+    void replacedConnectionWhileQuerying();
+private:
+    static qint64 queriesExecuted(const MSqlDatabase& db);
+};
+
+void MSqlQueryTest::initTestCase() {
+    MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(":memory:");
+    QVERIFY2(db.open(), qPrintable(db.lastError().text()));
+    MSqlQuery query(nullptr, db);
+    QVERIFY(query.exec("create table people (id integer primary key, name varchar(20))"));
+    QVariantList names;
+    for(int i=0; i<tableRowCount; i++)
+        names << QString("name%0").arg(i);
+    query.prepare("insert into people(name) values(?)");
+    query.addBindValue(names);
+    QVERIFY2(query.execBatch(), qPrintable(query.lastError().text()));
+}
+
+void MSqlQueryTest::cleanupTestCase() {
+    MSqlDatabase::database(connectionName).close();
+}
+
+qint64 MSqlQueryTest::queriesExecuted(const MSqlDatabase &db) {
+    qint64 queries = 0;
+    for(const MSqlConnectionStatistics& statistics : db.statistics())
+        queries += statistics.queriesExecuted;
+    return queries;
+}
+
+void MSqlQueryTest::unknownConnection() {
+    //queries on a connection name that has not been added fail (with warnings) instead of crashing
+    MSqlDatabase db = MSqlDatabase::database(QStringLiteral("msqlquery_tests_unknown"));
+    MSqlQuery query(nullptr, db);
+    QVERIFY(!query.exec("select 1"));
+    QCOMPARE(query.lastError().type(), QSqlError::ConnectionError);
+    QFuture<MSqlResult> future = query.execAsync("select 1");
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().lastError().type(), QSqlError::ConnectionError);
+    QCOMPARE(db.statementCacheCapacity(), 0);
+    QVERIFY(!db.isOpen());
+}
+
+void MSqlQueryTest::execAsyncDeliversResults() {
+    //results cross from the connection's thread to this thread through queued connections
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    QSignalSpy resultsSpy(&query, &MSqlQuery::resultsReady);
+    QFuture<MSqlResult> future = query.execAsync("select id, name from people order by id");
+    QTRY_COMPARE(resultsSpy.count(), 1);
+    QCOMPARE(resultsSpy.first().first().toBool(), true);
+    QVERIFY(future.isFinished());
+    QCOMPARE(future.result().rowCount(), tableRowCount);
+    QCOMPARE(query.result().value(0, "name").toString(), QString("name0"));
+    QVERIFY(!query.isBusy());
+}
+
+void MSqlQueryTest::modelResetsOnEveryExecution() {
+    MSqlQueryModel model;
+    MSqlQuery* query = new MSqlQuery(nullptr, MSqlDatabase::database(connectionName));
+    query->setChunkSize(30); //rows are streamed, the model appends chunks after the first one
+    query->prepare("select id, name from people");
+    model.setQueryAsync(query);
+    QSignalSpy resetSpy(&model, &QAbstractItemModel::modelReset);
+    for(int execution=1; execution<=2; execution++) {
+        QFuture<MSqlResult> future = query->execAsync();
+        QTRY_VERIFY(future.isFinished());
+        QCOMPARE(resetSpy.count(), execution);
+        QCOMPARE(model.rowCount(), tableRowCount);
+    }
+}
+
+void MSqlQueryTest::pipelinedPlaceholderBinds() {
+    MSqlQuery query(nullptr, MSqlDatabase::database(connectionName));
+    query.setPipelined(true);
+    query.prepare("select name from people where id = :id");
+    QList<QFuture<MSqlResult>> futures;
+    for(int i=1; i<=20; i++) {
+        //binding the placeholder again replaces its value
+        query.bindValue(":id", i);
+        futures << query.execAsync();
+    }
+    QTRY_VERIFY(futures.last().isFinished());
+    for(int i=0; i<futures.size(); i++) {
+        QVERIFY(futures.at(i).isFinished());
+        QCOMPARE(futures.at(i).result().value(0, 0).toString(), QString("name%0").arg(i));
+    }
+}
+
+void MSqlQueryTest::cachedStatementDropsBinds() {
+    MSqlDatabase db = MSqlDatabase::database(connectionName);
+    MSqlQuery first(nullptr, db);
+    first.prepare("select name from people where id = :id");
+    first.bindValue(":id", 3);
+    QVERIFY(first.exec());
+    QCOMPARE(first.result().rowCount(), 1);
+    //the second query reuses the cached statement, without binding the placeholder
+    MSqlQuery second(nullptr, db);
+    second.prepare("select name from people where id = :id");
+    QFuture<MSqlResult> future = second.execAsync();
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().rowCount(), 0);
+}
+
+void MSqlQueryTest::overwrittenQueryIsCanceled() {
+    MSqlDatabase db = MSqlDatabase::database(connectionName);
+    MSqlQuery query(nullptr, db);
+    QSignalSpy resultsSpy(&query, &MSqlQuery::resultsReady);
+    QFuture<MSqlResult> first;
+    QFuture<MSqlResult> second;
+    {
+        ThreadBlocker blocker(db.connectionContext());
+        first = query.execAsync("select id from people");
+        second = query.execAsync("select id from people where id <= 10");
+    }
+    QTRY_VERIFY(second.isFinished());
+    QVERIFY(first.isCanceled());
+    QCOMPARE(second.result().rowCount(), 10);
+    QTest::qWait(50); //the overwritten query must not deliver anything later
+    QCOMPARE(resultsSpy.count(), 1);
+}
+
+void MSqlQueryTest::singleFlightSharesExecution() {
+    MSqlDatabase db = MSqlDatabase::database(connectionName);
+    MSqlQuery leader(nullptr, db);
+    MSqlQuery follower(nullptr, db);
+    leader.setSingleFlight(true);
+    follower.setSingleFlight(true);
+    qint64 queriesBefore = queriesExecuted(db);
+    QFuture<MSqlResult> leaderFuture;
+    QFuture<MSqlResult> followerFuture;
+    {
+        //both queries are submitted before the leader can run
+        ThreadBlocker blocker(db.connectionContext());
+        leaderFuture = leader.execAsync("select count(*) from people");
+        followerFuture = follower.execAsync("select count(*) from people");
+    }
+    QTRY_VERIFY(leaderFuture.isFinished() && followerFuture.isFinished());
+    QCOMPARE(leaderFuture.result().value(0, 0).toInt(), tableRowCount);
+    QCOMPARE(followerFuture.result().value(0, 0).toInt(), tableRowCount);
+    QCOMPARE(queriesExecuted(db) - queriesBefore, qint64(1));
+}
+
+void MSqlQueryTest::routedReads() {
+    //readers only see the writer's tables if they share a database file
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MSqlDatabase db = MSqlDatabase::addRoutedDatabase("QSQLITE", 2, QStringLiteral("msqlquery_tests_routed"));
+    db.setDatabaseName(dir.filePath("routed.sqlite"));
+    QVERIFY(db.open());
+    QVERIFY(db.isRouted());
+    QCOMPARE(db.readerCount(), 2);
+    MSqlQuery query(nullptr, db);
+    QVERIFY(query.exec("pragma journal_mode=wal"));
+    QVERIFY(query.exec("create table items (id integer primary key)"));
+    QVERIFY(query.exec("insert into items(id) values(1)"));
+    QList<MSqlConnectionStatistics> before = db.statistics();
+    QVERIFY(query.exec("select count(*) from items"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 1);
+    QList<MSqlConnectionStatistics> after = db.statistics();
+    //the writer (the first connection) did not execute the select, one of the readers did
+    QCOMPARE(after.at(0).queriesExecuted, before.at(0).queriesExecuted);
+    QCOMPARE(after.at(1).queriesExecuted + after.at(2).queriesExecuted,
+             before.at(1).queriesExecuted + before.at(2).queriesExecuted + 1);
+    db.close();
+}
+
+void MSqlQueryTest::priorityOrder() {
+    MSqlThread thread;
+    QStringList order;
+    QMutex mutex;
+    auto job = [&](const QString& name){
+        return [&, name]{
+            QMutexLocker locker(&mutex);
+            order << name;
+        };
+    };
+    {
+        ThreadBlocker blocker(thread.getWorker());
+        thread.postJob(thread.getWorker(), MSqlPriority::Background, job("background"));
+        thread.postJob(thread.getWorker(), MSqlPriority::Normal, job("normal1"));
+        thread.postJob(thread.getWorker(), MSqlPriority::Interactive, job("interactive"));
+        thread.postJob(thread.getWorker(), MSqlPriority::Normal, job("normal2"));
+    }
+    QTRY_COMPARE(thread.load(), 0);
+    QMutexLocker locker(&mutex);
+    QCOMPARE(order, QStringList() << "interactive" << "normal1" << "normal2" << "background");
+}
+
+void MSqlQueryTest::priorityAging() {
+    MSqlThread thread;
+    QStringList order;
+    QMutex mutex;
+    auto job = [&](const QString& name){
+        return [&, name]{
+            QMutexLocker locker(&mutex);
+            order << name;
+        };
+    };
+    {
+        ThreadBlocker blocker(thread.getWorker());
+        thread.postJob(thread.getWorker(), MSqlPriority::Background, job("background"));
+        //the background job is raised above Interactive after waiting for more than 2 aging intervals
+        QTest::qSleep(MSqlThread::agingInterval*3 + 50);
+        thread.postJob(thread.getWorker(), MSqlPriority::Interactive, job("interactive"));
+    }
+    QTRY_COMPARE(thread.load(), 0);
+    QMutexLocker locker(&mutex);
+    QCOMPARE(order, QStringList() << "background" << "interactive");
+}
+
+void MSqlQueryTest::newWorkerRunsFirstJob() {
+    MSqlDatabase db = MSqlDatabase::database(connectionName);
+    MSqlQuery background(nullptr, db);
+    background.setPriority(MSqlPriority::Background);
+    QScopedPointer<MSqlQuery> lazy;
+    QFuture<MSqlResult> backgroundFuture;
+    QFuture<MSqlResult> lazyFuture;
+    {
+        ThreadBlocker blocker(db.connectionContext());
+        backgroundFuture = background.execAsync("select count(*) from people");
+        //the event posted by the background job runs the interactive query first, as the first job of a new worker
+        lazy.reset(new MSqlQuery(nullptr, db));
+        lazy->setPriority(MSqlPriority::Interactive);
+        lazy->setChunkSize(10);
+        lazy->setLazyFetch(true);
+        lazyFuture = lazy->execAsync("select id from people");
+    }
+    QTRY_VERIFY(backgroundFuture.isFinished() && lazyFuture.isFinished());
+    QCOMPARE(backgroundFuture.result().value(0, 0).toInt(), tableRowCount);
+    QCOMPARE(lazyFuture.result().rowCount(), 10);
+    QVERIFY(lazy->canFetchMore());
+}
+
+void MSqlQueryTest::sharedThreads() {
+    MSqlDatabase::setSharedThreadCount(2);
+    QSet<QThread*> threads;
+    QList<MSqlDatabase> databases;
+    for(int i=0; i<4; i++) {
+        MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", QString("msqlquery_tests_shared%0").arg(i));
+        db.setDatabaseName(":memory:");
+        QVERIFY(db.open());
+        threads.insert(db.connectionContext()->thread());
+        databases << db;
+    }
+    MSqlDatabase::setSharedThreadCount(0);
+    //connections are spread over both shared threads, and never get a thread of their own
+    QCOMPARE(threads.size(), 2);
+    for(const MSqlDatabase& db : databases) {
+        MSqlQuery query(nullptr, db);
+        QFuture<MSqlResult> future = query.execAsync("select 1");
+        QTRY_VERIFY(future.isFinished());
+        QCOMPARE(future.result().value(0, 0).toInt(), 1);
+    }
+}
+
+void MSqlQueryTest::tracerFailsOnFailedWrites() {
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::ReadOnly)); //writing to the buffer fails
+    QVERIFY(!MSqlTracer::write(&buffer));
+    buffer.close();
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+    QVERIFY(MSqlTracer::write(&buffer));
+}
+
+void MSqlQueryTest::replacedConnection() {
+    //the new connection opens the same database file, so that the writes started on the old one can go on
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MSqlDatabase::setSharedThreadCount(1);
+    const QString name = QStringLiteral("msqlquery_tests_replaced");
+    MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", name);
+    db.setDatabaseName(dir.filePath("replaced.sqlite"));
+    QVERIFY(db.open());
+    MSqlQuery query(nullptr, db);
+    QVERIFY(query.exec("create table items (id integer)"));
+    //a write buffer holding a pending batch
+    MSqlWriteBuffer buffer("insert into items(id) values(?)", db);
+    buffer.setMaxDelay(60000);
+    QFuture<MSqlResult> batch = buffer.addRow(QVariantList() << -1);
+    //and a load running one row per chunk
+    QByteArray csv;
+    for(int i=0; i<200; i++)
+        csv += QByteArray::number(i) + "\n";
+    QBuffer device(&csv);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    MSqlBulkLoader loader("insert into items(id) values(?)", nullptr, db);
+    loader.setChunkSize(1);
+    QFuture<MSqlResult> load = loader.load(&device);
+    //the query's worker is destroyed with the old connection, the query moves to the new one
+    db = MSqlDatabase::addDatabase("QSQLITE", name);
+    MSqlDatabase::setSharedThreadCount(0);
+    db.setDatabaseName(dir.filePath("replaced.sqlite"));
+    QVERIFY(db.open());
+    QFuture<MSqlResult> future = query.execAsync("select 2");
+    QTRY_VERIFY(future.isFinished());
+    QCOMPARE(future.result().value(0, 0).toInt(), 2);
+    //the batch and the remaining chunks are executed on the new connection
+    QVERIFY(!batch.isFinished());
+    buffer.flush();
+    QTRY_VERIFY(batch.isFinished() && load.isFinished());
+    QVERIFY2(batch.result().isSuccess(), qPrintable(batch.result().lastError().text()));
+    QVERIFY2(load.result().isSuccess(), qPrintable(load.result().lastError().text()));
+    QVERIFY(query.exec("select count(*) from items"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 201);
+    db.close();
+}
+
+//executes blocking queries in a loop until stopped, using a query object living in the thread
+class QueryLoopThread : public QThread {
+public:
+    explicit QueryLoopThread(const QString& connectionName): m_connectionName(connectionName) {}
+    QAtomicInt isStopped;
+    QAtomicInt succeeded;
+protected:
+    void run() override {
+        MSqlQuery query(nullptr, MSqlDatabase::database(m_connectionName));
+        while(!isStopped.load()) {
+            if(query.exec("select 1")) //fails while the new connection is not open yet
+                succeeded.ref();
+        }
+    }
+private:
+    QString m_connectionName;
+};
+
+void MSqlQueryTest::replacedConnectionWhileQuerying() {
+    const QString name = QStringLiteral("msqlquery_tests_replaced_busy");
+    MSqlDatabase db = MSqlDatabase::addDatabase("QSQLITE", name);
+    db.setDatabaseName(":memory:");
+    QVERIFY(db.open());
+    QueryLoopThread thread(name);
+    thread.start();
+    QTRY_VERIFY(thread.succeeded.load() > 0);
+    //the query's workers are destroyed while the other thread is using them
+    for(int i=0; i<10; i++) {
+        db = MSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(":memory:");
+        QVERIFY(db.open());
+    }
+    int succeeded = thread.succeeded.load();
+    QTRY_VERIFY(thread.succeeded.load() > succeeded); //the query has moved to the last connection
+    thread.isStopped.store(1);
+    QVERIFY(thread.wait(5000));
+}
+
+QTEST_GUILESS_MAIN(MSqlQueryTest)
+
+#include "tst_msqlquery.moc"